@@ -16,6 +16,12 @@ $ctool -d $testdir/data -m single-link > $testdir/csingle-link
 
 echo "================================================================================"
 
+echo "single-link-kdtree"
+$ctool -d $testdir/data -m single-link-kdtree > $testdir/csingle-link-kdtree
+./compare-results.R $testdir/csingle-link-kdtree $testdir/Rsingle-link
+
+echo "================================================================================"
+
 echo "matrix-single-link"
 $ctool -d $testdir/data -m matrix-single-link > $testdir/cmatrix-single-link
 ./compare-results.R $testdir/cmatrix-single-link $testdir/Rsingle-link
@@ -29,6 +35,12 @@ $ctool -d $testdir/data -m complete-link > $testdir/ccomplete-link
 
 echo "================================================================================"
 
+echo "matrix-complete-link"
+$ctool -d $testdir/data -m matrix-complete-link > $testdir/cmatrix-complete-link
+./compare-results.R $testdir/cmatrix-complete-link $testdir/Rcomplete-link
+
+echo "================================================================================"
+
 echo "ward"
 $ctool -d $testdir/data -m ward > $testdir/cward
 ./cluster-testdata.R $testdir/data ward > $testdir/Rward
@@ -36,6 +48,33 @@ $ctool -d $testdir/data -m ward > $testdir/cward
 
 echo "================================================================================"
 
+echo "matrix-ward"
+$ctool -d $testdir/data -m matrix-ward > $testdir/cmatrix-ward
+./compare-results.R $testdir/cmatrix-ward $testdir/Rward
+
+echo "================================================================================"
+
+echo "ward with precomputed dissimilarities"
+$ctool -d $testdir/data -m single-link --write-dissimilarities $testdir/dissimilarities.npy --join-file ""
+$ctool --dissimilarity-file $testdir/dissimilarities.npy -m ward > $testdir/cward-precomputed
+./compare-results.R $testdir/cward-precomputed $testdir/Rward
+
+echo "================================================================================"
+
+echo "complete-link with the manhattan metric"
+$ctool -d $testdir/data -m complete-link --metric manhattan > $testdir/ccomplete-link-manhattan
+./cluster-testdata.R $testdir/data complete manhattan > $testdir/Rcomplete-link-manhattan
+./compare-results.R $testdir/{c,R}complete-link-manhattan
+
+echo "================================================================================"
+
+echo "complete-link with the chebyshev metric"
+$ctool -d $testdir/data -m complete-link --metric chebyshev > $testdir/ccomplete-link-chebyshev
+./cluster-testdata.R $testdir/data complete maximum > $testdir/Rcomplete-link-chebyshev
+./compare-results.R $testdir/{c,R}complete-link-chebyshev
+
+echo "================================================================================"
+
 echo "group-average"
 $ctool -d $testdir/data -m group-average > $testdir/cgroup-average
 ./cluster-testdata.R $testdir/data average > $testdir/Rgroup-average
@@ -43,6 +82,12 @@ $ctool -d $testdir/data -m group-average > $testdir/cgroup-average
 
 echo "================================================================================"
 
+echo "matrix-group-average"
+$ctool -d $testdir/data -m matrix-group-average > $testdir/cmatrix-group-average
+./compare-results.R $testdir/cmatrix-group-average $testdir/Rgroup-average
+
+echo "================================================================================"
+
 echo "weighted-group-average"
 $ctool -d $testdir/data -m weighted-group-average > $testdir/cweighted-group-average
 ./cluster-testdata.R $testdir/data mcquitty > $testdir/Rweighted-group-average
@@ -50,11 +95,23 @@ $ctool -d $testdir/data -m weighted-group-average > $testdir/cweighted-group-ave
 
 echo "================================================================================"
 
+echo "matrix-weighted-group-average"
+$ctool -d $testdir/data -m matrix-weighted-group-average > $testdir/cmatrix-weighted-group-average
+./compare-results.R $testdir/cmatrix-weighted-group-average $testdir/Rweighted-group-average
+
+echo "================================================================================"
+
 echo "centroid"
 $ctool -d $testdir/data -m centroid > $testdir/ccentroid
 ./cluster-testdata.R $testdir/data centroid > $testdir/Rcentroid
 ./compare-results.R $testdir/{c,R}centroid
 
+echo "================================================================================"
+
+echo "matrix-centroid"
+$ctool -d $testdir/data -m matrix-centroid > $testdir/cmatrix-centroid
+./compare-results.R $testdir/cmatrix-centroid $testdir/Rcentroid
+
 
 echo "================================================================================"
 
@@ -63,3 +120,141 @@ $ctool -d $testdir/data -m median > $testdir/cmedian
 ./cluster-testdata.R $testdir/data median > $testdir/Rmedian
 ./compare-results.R $testdir/{c,R}median
 
+echo "================================================================================"
+
+echo "matrix-median"
+$ctool -d $testdir/data -m matrix-median > $testdir/cmatrix-median
+./compare-results.R $testdir/cmatrix-median $testdir/Rmedian
+
+echo "================================================================================"
+
+for m in ward centroid median; do
+    echo "geometric-$m"
+    $ctool -d $testdir/data -m geometric-$m > $testdir/cgeometric-$m
+    ./cluster-testdata.R $testdir/data $m squared-euclidean > $testdir/Rgeometric-$m
+    ./compare-results.R $testdir/{c,R}geometric-$m
+done
+
+echo "================================================================================"
+
+# single precision against the double runs above
+for p in float mixed; do
+    for m in single-link complete-link ward group-average centroid matrix-ward geometric-ward; do
+	echo "$m --precision $p"
+	$ctool -d $testdir/data -m $m --precision $p > $testdir/c$m-$p
+	./height-deviation.R $testdir/c$m-$p $testdir/c$m
+    done
+done
+
+echo "================================================================================"
+
+# the state of earlier runs grows by the data points added, the last
+# run has all of them
+echo "single-link with --state-file (1, 100, 250 data points)"
+rm -f $testdir/state
+for k in 1 100 250; do
+    head -n $k $testdir/data > $testdir/data-$k
+    $ctool -d $testdir/data-$k -m single-link --state-file $testdir/state > $testdir/csingle-link-state
+done
+./compare-results.R $testdir/csingle-link-state $testdir/csingle-link
+
+echo "================================================================================"
+
+# three datasets in one batch against one run each
+echo "ward with --batch"
+head -n 80 $testdir/data > $testdir/batch-1
+sed -n 81,170p $testdir/data > $testdir/batch-2
+tail -n 80 $testdir/data > $testdir/batch-3
+rm -f $testdir/manifest $testdir/cward-single
+for b in 1 2 3; do
+    echo $testdir/batch-$b >> $testdir/manifest
+    $ctool -d $testdir/batch-$b -m ward --join-file $testdir/cward-$b
+    (echo "# $testdir/batch-$b"; cat $testdir/cward-$b) >> $testdir/cward-single
+done
+$ctool --batch $testdir/manifest -m ward --threads 3 > $testdir/cward-batch
+cmp $testdir/cward-batch $testdir/cward-single && echo "identical"
+
+echo "================================================================================"
+
+# the binary join-file read back with --read-linkage, then broken ones
+echo "ward with --join-format binary"
+$ctool -d $testdir/data -m ward --join-format binary --join-file $testdir/cward.bin
+$ctool --read-linkage $testdir/cward.bin > $testdir/cward-binary
+cmp $testdir/cward-binary $testdir/cward && echo "identical"
+head -c 100 $testdir/cward.bin > $testdir/truncated.bin
+# 3 data points, the first merge joins a vertex that does not exist yet
+printf 'clusterol-linkage 3 2 8\n\005\000\000\000\001\000\000\000\000\000\000\000\000\000\360\077' > $testdir/invalid.bin
+printf '\003\000\000\000\002\000\000\000\000\000\000\000\000\000\000\100' >> $testdir/invalid.bin
+$ctool -d $testdir/data -m ward --precision float --join-format binary --join-file $testdir/cward-float.bin
+for b in truncated invalid cward-float; do
+    $ctool --read-linkage $testdir/$b.bin > /dev/null 2>&1 && echo "$b.bin was not rejected"
+done
+
+echo "================================================================================"
+
+echo "ward with --newick-file"
+$ctool -d $testdir/data -m ward --newick-file $testdir/cward.newick --join-file ""
+./compare-newick.R $testdir/cward.newick $testdir/cward
+
+echo "================================================================================"
+
+# 750 data points need 2.2 MB for their dissimilarities, with a limit
+# of 1 MB they are kept in a scratch file
+echo "matrix methods with --memory-limit 1"
+(./generate-testdata.R; ./generate-testdata.R; ./generate-testdata.R) > $testdir/data-750
+mkdir -p $testdir/scratch
+for m in matrix-single-link matrix-complete-link matrix-ward matrix-group-average matrix-weighted-group-average \
+	 matrix-centroid matrix-median; do
+    $ctool -d $testdir/data-750 -m $m > $testdir/c$m-750
+    $ctool -d $testdir/data-750 -m $m --memory-limit 1 --scratch-dir $testdir/scratch > $testdir/c$m-750-scratch
+    cmp $testdir/c$m-750 $testdir/c$m-750-scratch && echo "$m: identical"
+done
+# the dissimilarities are written in blocks of at most 1 MB
+echo "--write-dissimilarities with --memory-limit 1"
+$ctool -d $testdir/data-750 -m single-link --write-dissimilarities $testdir/dissimilarities-750.npy --join-file ""
+$ctool -d $testdir/data-750 -m single-link --memory-limit 1 --write-dissimilarities $testdir/dissimilarities-750-blocks.npy --join-file ""
+cmp $testdir/dissimilarities-750.npy $testdir/dissimilarities-750-blocks.npy && echo "identical"
+# 6000 data points need 144 MB in the scratch file, a merge should
+# cost about as much as in memory, not a multiple
+echo "matrix-ward with --memory-limit 20, timed"
+for i in $(seq 24); do ./generate-testdata.R; done > $testdir/data-6000
+start=$(date +%s.%N)
+$ctool -d $testdir/data-6000 -m matrix-ward > $testdir/cmatrix-ward-6000
+middle=$(date +%s.%N)
+$ctool -d $testdir/data-6000 -m matrix-ward --memory-limit 20 --scratch-dir $testdir/scratch > $testdir/cmatrix-ward-6000-scratch
+end=$(date +%s.%N)
+cmp $testdir/cmatrix-ward-6000 $testdir/cmatrix-ward-6000-scratch && echo "identical"
+awk -v s=$start -v m=$middle -v e=$end 'BEGIN {
+  printf "in memory %.1f s, with a scratch file %.1f s\n", m - s, e - m
+  if(e - m > 4 * (m - s)) print "the scratch file is too slow"}'
+
+echo "================================================================================"
+
+# a stopped run is the start of the full join report: all but the last
+# 9 merges with --stop-at-k 10, up to the first merge above the mean
+# height of the 200th and 201st merge with --max-height (not at a
+# height, which is rounded in the join report)
+for m in single-link ward centroid matrix-ward geometric-ward; do
+    echo "$m with --stop-at-k and --max-height"
+    $ctool -d $testdir/data -m $m > $testdir/c$m-full
+    $ctool -d $testdir/data -m $m --stop-at-k 10 > $testdir/c$m-k10
+    head -n 240 $testdir/c$m-full | cmp - $testdir/c$m-k10 && echo "stop-at-k: identical prefix"
+    h=$(sed -n 200,201p $testdir/c$m-full | awk '{s += $3} END {printf "%.17g", s / 2}')
+    $ctool -d $testdir/data -m $m --max-height $h > $testdir/c$m-h
+    awk -v h=$h '$3 > h {exit} {print}' $testdir/c$m-full | cmp - $testdir/c$m-h && echo "max-height: identical prefix"
+done
+
+echo "================================================================================"
+
+# the first 50 data points three times more, the first one 40 times
+# more: a leaf of the kd-tree holds 41 equal data points
+echo "single-link-kdtree with duplicate data points"
+(cat $testdir/data; for i in 1 2 3; do head -n 50 $testdir/data; done
+ awk 'NR == 1 {for(i = 0; i < 40; ++i) print}' $testdir/data) > $testdir/data-duplicates
+$ctool -d $testdir/data-duplicates -m single-link > $testdir/csingle-link-duplicates
+$ctool -d $testdir/data-duplicates -m single-link-kdtree > $testdir/csingle-link-kdtree-duplicates
+./height-deviation.R $testdir/csingle-link-kdtree-duplicates $testdir/csingle-link-duplicates
+echo "geometric-ward with duplicate data points"
+$ctool -d $testdir/data-duplicates -m ward --metric squared-euclidean > $testdir/cward-squared-duplicates
+$ctool -d $testdir/data-duplicates -m geometric-ward > $testdir/cgeometric-ward-duplicates
+./height-deviation.R $testdir/cgeometric-ward-duplicates $testdir/cward-squared-duplicates
@@ -0,0 +1,250 @@
+#include "input_output.hpp"
+#include "clusterol/cluster.hpp"
+#include "clusterol/dissimilarity.hpp"
+#include "clusterol/dissimilarity_matrix.hpp"
+#include "clusterol/minimum_spanning_tree.hpp"
+#include "clusterol/join_report.hpp"
+#include "clusterol/dendrogram_output.hpp"
+#include "clusterol/parallel.hpp"
+#include "clusterol/row_view.hpp"
+#include <boost/program_options.hpp>
+#include <boost/graph/adjacency_list.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+
+// Time the clustering methods and their building blocks on uniformly
+// random data points for every combination of n and d, write JSON.
+
+namespace{
+  struct result{
+    std::string name;
+    size_t n, d;
+    std::string unit;		// what items counts
+    double items;
+    std::vector<double> seconds;	// one per repetition
+    size_t peak_rss;		// bytes
+  };
+
+
+  void reset_peak_rss(){
+    // Linux: start a new high-water mark for VmHWM, elsewhere the peak
+    // of the whole process is reported
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+  }
+
+  size_t peak_rss(){
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)){
+      if(line.compare(0, 6, "VmHWM:") == 0)
+	return std::strtoul(line.c_str() + 6, 0, 10) << 10;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) << 10;
+  }
+
+
+  template <typename function>
+  void measure(std::vector<result>& results, const std::string& name, size_t n, size_t d, const std::string& unit, double items,
+	       size_t repeat, function f){
+    // run f repeat times, each call does the whole work once
+    result r = {name, n, d, unit, items, std::vector<double>(), 0};
+    for(size_t i = 0; i != repeat; ++i){
+      reset_peak_rss();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      f();
+      r.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      r.peak_rss = std::max(r.peak_rss, peak_rss());
+    }
+    std::cerr << name << " n=" << n << " d=" << d << ": " << *std::min_element(r.seconds.begin(), r.seconds.end()) << " s\n";
+    results.push_back(r);
+  }
+
+
+  void write_json(std::ostream& out, const std::vector<result>& results, int n_thread, size_t seed){
+    // minimum and median over the repetitions, the minimum is the
+    // least noisy estimate
+    out << std::setprecision(9)
+	<< "{\n  \"version\": \"" << CLUSTEROL_VERSION << "\",\n"
+	<< "  \"threads\": " << n_thread << ",\n"
+	<< "  \"seed\": " << seed << ",\n"
+	<< "  \"results\": [";
+    for(size_t i = 0; i != results.size(); ++i){
+      const result& r = results[i];
+      std::vector<double> sorted(r.seconds);
+      std::sort(sorted.begin(), sorted.end());
+      double median = sorted.size() % 2 ? sorted[sorted.size() / 2] : (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+      out << (i ? ",\n" : "\n")
+	  << "    {\"name\": \"" << r.name << "\", \"n\": " << r.n << ", \"d\": " << r.d
+	  << ", \"repeat\": " << sorted.size()
+	  << ", \"seconds_min\": " << sorted.front() << ", \"seconds_median\": " << median
+	  << ", \"unit\": \"" << r.unit << "\", \"items\": " << r.items
+	  << ", \"items_per_second\": " << r.items / sorted.front()
+	  << ", \"peak_rss_bytes\": " << r.peak_rss << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+}
+
+
+int main(int argc, char *argv[]){
+
+  std::vector<size_t> n_sweep, d_sweep;
+  std::vector<std::string> method;
+  size_t repeat, seed;
+  int n_thread;
+  std::string output_filename, scratch_dir;
+
+  namespace po = boost::program_options;
+  po::options_description desc("Benchmark clusterol");
+
+  desc.add_options()
+    ("help", "produce help message\n")
+    ("n", po::value(&n_sweep)->multitoken(), "numbers of data points, default 500 1000 2000")
+    ("d", po::value(&d_sweep)->multitoken(), "dimensions, default 2 16")
+    ("method,m", po::value(&method)->multitoken(),
+     "methods of clusterol::cluster to time, default all, \"none\" only times the building blocks")
+    ("repeat", po::value(&repeat)->default_value(3), "repetitions of every measurement")
+    ("seed", po::value(&seed)->default_value(1), "seed of the random data points")
+    ("threads", po::value(&n_thread)->default_value(0), "number of threads, 0 uses all cores")
+    ("output,o", po::value(&output_filename)->default_value("-"), "JSON output, \"-\" is stdout")
+    ("scratch-dir", po::value(&scratch_dir), "directory for the data-point file, default $TMPDIR or /tmp")
+    ;
+
+  po::variables_map vm;
+  try{
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  }catch(std::exception& e){
+    std::cerr << "An error occured while parsing the options:\n"
+	      << e.what() << "\n";
+    exit(1);
+  }
+
+  if(vm.count("help")){
+    std::cout << desc << "\n";
+    exit(0);
+  }
+
+  if(n_sweep.empty()){
+    n_sweep.push_back(500); n_sweep.push_back(1000); n_sweep.push_back(2000);
+  }
+  if(d_sweep.empty()){
+    d_sweep.push_back(2); d_sweep.push_back(16);
+  }
+  if(method.empty()){
+    method.assign(std::begin(clusterol::method_names), std::end(clusterol::method_names));
+  }else if(method.size() == 1 && method[0] == "none"){
+    method.clear();
+  }
+  if(repeat == 0 || *std::min_element(n_sweep.begin(), n_sweep.end()) < 2 || *std::min_element(d_sweep.begin(), d_sweep.end()) < 1){
+    std::cerr << "Need repeat >= 1, n >= 2 and d >= 1\n";
+    exit(1);
+  }
+  if(scratch_dir.empty())
+    scratch_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+  clusterol::set_num_threads(n_thread);
+
+  typedef clusterol::dissimilarity_be<clusterol::euclidean_distance> dissimilarity_t;
+  typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::undirectedS, boost::no_property,
+				boost::property<boost::edge_weight_t, double> > mst_type;
+  std::vector<result> results;
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  for(size_t i_n = 0; i_n != n_sweep.size(); ++i_n){
+    for(size_t i_d = 0; i_d != d_sweep.size(); ++i_d){
+      size_t n = n_sweep[i_n], d = d_sweep[i_d];
+      double n_pair = double(n) * (n - 1) / 2;
+      std::vector<double> value(n * d);
+      for(size_t k = 0; k != value.size(); ++k)
+	value[k] = uniform(rng);
+      clusterol::row_iterator<double> data = clusterol::rows_begin(value.data(), d, d),
+	data_end = clusterol::rows_end(value.data(), n, d, d);
+
+      // parsing, from a file written with full precision
+      std::string filename = scratch_dir + "/clusterol-bench-" + x_to_string(getpid()) + ".txt";
+      {
+	std::ofstream file(filename.c_str());
+	file << std::setprecision(17);
+	for(size_t k = 0; k != n; ++k){
+	  for(size_t j = 0; j != d; ++j)
+	    file << (j ? " " : "") << value[k * d + j];
+	  file << "\n";
+	}
+	if(!file.good()){
+	  std::cerr << "Could not write " << filename << "\n";
+	  exit(1);
+	}
+      }
+      std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+      double n_byte = file.tellg();
+      measure(results, "read_data_points", n, d, "bytes", n_byte, repeat, [&](){
+	  if(read_data_points(filename).n_row != n)
+	    abort();
+	});
+      std::remove(filename.c_str());
+
+      measure(results, "dissimilarity_matrix", n, d, "pairs", n_pair, repeat, [&](){
+	  clusterol::dissimilarity_matrix<double> dis_mat(data, data_end, dissimilarity_t());
+	});
+
+      mst_type mst;
+      measure(results, "minimum_spanning_tree", n, d, "pairs", n_pair, repeat, [&](){
+	  clusterol::minimum_spanning_tree(data, data_end, mst, get(boost::edge_weight, mst), dissimilarity_t());
+	});
+
+      measure(results, "get_tree_from_mst", n, d, "data_points", n, repeat, [&](){
+	  boost::adjacency_list<> tree;
+	  std::vector<double> h(2 * n - 1);
+	  std::vector<boost::graph_traits<mst_type>::edge_descriptor> corresponding_edge(2 * n - 1);
+	  clusterol::get_tree_from_mst(tree, h.begin(), corresponding_edge.begin(), mst, get(boost::edge_weight, mst));
+	});
+
+      clusterol::dendrogram<> dend(n);
+      clusterol::dendrogram_from_mst(dend, mst);
+      measure(results, "get_join_report", n, d, "merges", n - 1, repeat, [&](){
+	  if(clusterol::get_join_report(dend).size() != n - 1)
+	    abort();
+	});
+
+      measure(results, "write_join_report", n, d, "merges", n - 1, repeat, [&](){
+	  std::ostringstream out;
+	  clusterol::write_join_report(out, dend, 15);
+	  if(out.str().empty())
+	    abort();
+	});
+
+      for(size_t m = 0; m != method.size(); ++m){
+	measure(results, method[m], n, d, "data_points", n, repeat, [&](){
+	    clusterol::cluster<double>(data, data_end, method[m], dissimilarity_t());
+	  });
+      }
+    }
+  }
+
+  try{
+    std::ofstream out;
+    open_outfile(output_filename, out);
+    write_json(out, results, clusterol::num_threads(), seed);
+  }catch(std::exception& e){
+    std::cerr << "An error occured during output: \n"
+	      << e.what() << "\n";
+    exit(1);
+  }
+
+  return 0;
+}
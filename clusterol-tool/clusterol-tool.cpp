@@ -4,8 +4,15 @@
 #include "clusterol/lance_williams.hpp"
 #include "clusterol/matrix_based.hpp"
 #include "clusterol/cluster.hpp"
+#include "clusterol/parallel.hpp"
+#include "clusterol/row_view.hpp"
+#include "clusterol/precomputed.hpp"
+#include "clusterol/pdist.hpp"
+#include "clusterol/cut_tree.hpp"
+#include "clusterol/profile.hpp"
+#include "clusterol/incremental.hpp"
+#include "clusterol/dendrogram_output.hpp"
 #include <boost/program_options.hpp>
-#include <boost/graph/graphviz.hpp>
 #include <boost/version.hpp>
 #if BOOST_VERSION >= 104100
 #include <boost/property_map/property_map.hpp>
@@ -13,13 +20,399 @@
 #include <boost/property_map.hpp>
 #endif
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+
+
+template <typename height_type, typename value_type>
+clusterol::dendrogram<height_type> cluster_dissimilarities(const value_type* condensed, size_t n, const std::string& method,
+							   const clusterol::cluster_options& options){
+  // cluster n data points with precomputed dissimilarities
+  return clusterol::cluster<height_type>(clusterol::index_begin(), clusterol::index_end(n), method,
+					 clusterol::precomputed_dissimilarity<value_type>(condensed, n), options);
+}
+
+
+template <typename height_type, typename random_access_iterator, typename dissimilarity_t>
+clusterol::dendrogram<height_type> cluster_incrementally(random_access_iterator data, random_access_iterator data_end,
+							 dissimilarity_t dissimilarity, const clusterol::cluster_options& options,
+							 const std::string& state_filename){
+  // single link, the data points after those in the state file are
+  // inserted and the state file is replaced
+  clusterol::incremental_single_link<height_type> state;
+  try{
+    std::ifstream in(state_filename.c_str(), std::ios::binary);
+    if(in.is_open())
+      state.load(in);
+    if(state.size() > size_t(data_end - data))
+      throw(std::runtime_error("state-file has more data points than the data-point-file"));
+  }catch(std::exception& e){
+    std::cerr << "An error occured during input: \n"
+	      << e.what() << "\n";
+    exit(1);
+  }
+
+  state.insert(data, data_end, dissimilarity);
+
+  // a new file, renamed at the end, a failed run keeps the old state
+  try{
+    std::string tmp_filename = state_filename + ".tmp";
+    std::ofstream out(tmp_filename.c_str(), std::ios::binary);
+    if(!out.is_open())
+      throw(std::runtime_error("Could not open " + tmp_filename));
+    state.save(out);
+    out.close();
+    if(std::rename(tmp_filename.c_str(), state_filename.c_str()) != 0)
+      throw(std::runtime_error("Could not replace " + state_filename));
+  }catch(std::exception& e){
+    std::cerr << "An error occured during output: \n"
+	      << e.what() << "\n";
+    exit(1);
+  }
+  return state.get_dendrogram(options.stop);
+}
+
+
+inline bool needs_data_points(const std::string& method){
+  // single-link-kdtree and the geometric methods work on coordinates,
+  // not on a dissimilarity matrix
+  return method == "single-link-kdtree" || method.compare(0, 10, "geometric-") == 0;
+}
+
+
+// at most this many bytes of dissimilarities are in memory while
+// --write-dissimilarities writes them, less with a smaller memory limit
+const size_t dissimilarity_block_bytes = size_t(64) << 20;
+
+
+template <typename height_type, typename random_access_iterator, typename dissimilarity_t>
+void write_dissimilarities(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity,
+			   const std::string& filename, size_t memory_limit){
+  // the n(n-1)/2 dissimilarities as an npy file of height_type,
+  // computed and written in blocks of whole rows
+  CLUSTEROL_PROFILE_SCOPE("write_dissimilarities");
+  size_t n = data_end - data;
+  size_t block_bytes = memory_limit > 0 ? std::min(memory_limit, dissimilarity_block_bytes) : dissimilarity_block_bytes;
+  // at least one row
+  size_t block_size = std::max(block_bytes / sizeof(height_type), n);
+  size_t n_pair = clusterol::condensed_offset(n, n);
+  npy_writer file(filename, sizeof(height_type) == sizeof(double) ? "<f8" : "<f4", sizeof(height_type), n_pair);
+  std::vector<height_type> block;
+  block.reserve(std::min(block_size, n_pair));
+  for(size_t row_begin = 0, row_end; row_begin < n; row_begin = row_end){
+    size_t offset = clusterol::condensed_offset(row_begin, n);
+    for(row_end = row_begin + 1; row_end < n && clusterol::condensed_offset(row_end + 1, n) - offset <= block_size; ++row_end)
+      ;
+    block.resize(clusterol::condensed_offset(row_end, n) - offset);
+    clusterol::pdist(data, data_end, dissimilarity, block.begin(), row_begin, row_end);
+    file.write(block.data(), block.size());
+  }
+  file.close();
+}
+
+
+template <typename height_type, typename random_access_iterator, typename dissimilarity_t>
+clusterol::dendrogram<height_type> cluster_data(random_access_iterator data, random_access_iterator data_end, const std::string& method,
+						dissimilarity_t dissimilarity, const clusterol::cluster_options& options,
+						const std::string& dissimilarity_out, const std::string& state_filename){
+  // clusterol::cluster checks if method is available.
+  // With dissimilarity_out, the dissimilarities are computed once,
+  // written there (as height_type) and then clustered from the file
+  // like a dissimilarity-file, methods that need data points cluster
+  // the data points instead.
+  // With state_filename, single link is updated incrementally.
+  if(!state_filename.empty())
+    return cluster_incrementally<height_type>(data, data_end, dissimilarity, options, state_filename);
+  if(dissimilarity_out.empty())
+    return clusterol::cluster<height_type>(data, data_end, method, dissimilarity, options);
+
+  try{
+    write_dissimilarities<height_type>(data, data_end, dissimilarity, dissimilarity_out, options.memory_limit);
+  }catch(std::exception& e){
+    std::cerr << "An error occured during output: \n"
+	      << e.what() << "\n";
+    exit(1);
+  }
+  if(needs_data_points(method) || data_end - data < 2)
+    return clusterol::cluster<height_type>(data, data_end, method, dissimilarity, options);
+
+  mapped_file file(dissimilarity_out);
+  npy_array array = parse_npy(file);
+  return cluster_dissimilarities<height_type>(reinterpret_cast<const height_type*>(array.data), data_end - data, method, options);
+}
+
+
+template <typename distance_t, typename float_accumulator>
+struct accumulated{
+  // distance_t summing up float data points in float_accumulator
+  typedef distance_t type;
+};
+
+template <typename distance_t>
+struct accumulated<distance_t, double>{
+  typedef clusterol::double_accumulation<distance_t> type;
+};
+
+
+// the metrics cluster_rows parses
+const char* const metric_names[] = {"euclidean", "squared-euclidean", "manhattan", "chebyshev", "cosine", "hamming"};
+
+
+template <typename height_type, typename float_accumulator, typename coordinate_type>
+clusterol::dendrogram<height_type> cluster_rows(const coordinate_type* first, size_t n_row, size_t n_column, const std::string& metric,
+						const std::string& method, const clusterol::cluster_options& options,
+						const std::string& dissimilarity_out, const std::string& state_filename){
+  // cluster n_row data points stored row by row with metric, float
+  // data points are summed up in float_accumulator
+  clusterol::row_iterator<coordinate_type> data = clusterol::rows_begin(first, n_column, n_column),
+    data_end = clusterol::rows_end(first, n_row, n_column, n_column);
+
+  if(metric == "euclidean"){
+    typedef typename accumulated<clusterol::euclidean_distance, float_accumulator>::type distance_t;
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<distance_t>(), options, dissimilarity_out,
+				     state_filename);
+  }else if(metric == "squared-euclidean"){
+    typedef typename accumulated<clusterol::squared_euclidean_distance, float_accumulator>::type distance_t;
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<distance_t>(), options, dissimilarity_out,
+				     state_filename);
+  }else if(metric == "manhattan"){
+    typedef typename accumulated<clusterol::manhattan_distance, float_accumulator>::type distance_t;
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<distance_t>(), options, dissimilarity_out,
+				     state_filename);
+  }else if(metric == "chebyshev"){
+    typedef typename accumulated<clusterol::chebyshev_distance, float_accumulator>::type distance_t;
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<distance_t>(), options, dissimilarity_out,
+				     state_filename);
+  }else if(metric == "cosine"){
+    typedef typename accumulated<clusterol::cosine_distance, float_accumulator>::type distance_t;
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<distance_t>(), options, dissimilarity_out,
+				     state_filename);
+  }
+
+  // hamming: binary data is packed into bits and compared with popcount
+  // (counts are exact in any precision)
+  size_t n_word = clusterol::packed_words(n_column);
+  std::vector<uint64_t> bits(n_row * n_word);
+  bool binary = true;
+  for(size_t i = 0; i != n_row && binary; ++i)
+    binary = clusterol::pack_bits(first + i * n_column, first + (i + 1) * n_column, &bits[i * n_word]);
+  if(!binary)
+    return cluster_data<height_type>(data, data_end, method, clusterol::dissimilarity_be<clusterol::hamming_distance>(), options,
+				     dissimilarity_out, state_filename);
+
+  const uint64_t* bits_first = bits.data();
+  return cluster_data<height_type>(clusterol::rows_begin(bits_first, n_word, n_word), clusterol::rows_end(bits_first, n_row, n_word, n_word),
+				   method, clusterol::dissimilarity_be<clusterol::bit_hamming_distance>(), options, dissimilarity_out,
+				   state_filename);
+}
+
+
+inline const float* float_rows(const float* first, size_t, std::vector<float>&){
+  // float data points are used in place
+  return first;
+}
+
+inline const float* float_rows(const double* first, size_t n_value, std::vector<float>& rows){
+  // double data points are rounded to float once
+  rows.assign(first, first + n_value);
+  return rows.data();
+}
+
+
+template <typename coordinate_type>
+void cluster_rows(const coordinate_type* first, size_t n_row, size_t n_column, const std::string& metric,
+		  const std::string& method, const clusterol::cluster_options& options, const std::string& dissimilarity_out,
+		  const std::string& state_filename, const std::string& precision, clusterol::dendrogram<double>& dend,
+		  clusterol::dendrogram<float>& dend_float, std::vector<float>& rows){
+  // cluster_rows with precision "double" (dend), "float" or "mixed"
+  // (float data points, matrix and heights in dend_float, "mixed" sums
+  // up distances in double). rows holds double data points rounded to
+  // float, its memory is reused.
+  if(precision == "double"){
+    dend = cluster_rows<double, float>(first, n_row, n_column, metric, method, options, dissimilarity_out, state_filename);
+    return;
+  }
+
+  const float* float_first = float_rows(first, n_row * n_column, rows);
+  if(precision == "float")
+    dend_float = cluster_rows<float, float>(float_first, n_row, n_column, metric, method, options, dissimilarity_out, state_filename);
+  else
+    dend_float = cluster_rows<float, double>(float_first, n_row, n_column, metric, method, options, dissimilarity_out, state_filename);
+}
+
+
+template <typename height_type>
+void write_results(const clusterol::dendrogram<height_type>& dend, const boost::program_options::variables_map& vm,
+		   std::ostream& graph_out, std::ostream& join_out, std::ostream& newick_out, std::ostream& cluster_out,
+		   const std::string& join_format, const std::string& cluster_filename, const std::string& cluster_format){
+  // the requested output files of dend
+  // 15 digits for double, all 9 for float
+  int digits = std::min(15, std::numeric_limits<height_type>::max_digits10);
+  if(vm.count("graph-file")){
+    CLUSTEROL_PROFILE_SCOPE("write_graph");
+    clusterol::write_graphviz(graph_out, dend);
+    graph_out.flush();
+  }
+
+  if(vm.count("join-file")){
+    CLUSTEROL_PROFILE_SCOPE("write_join_file");
+    if(join_format == "text")
+      clusterol::write_join_report(join_out, dend, digits);
+    else
+      clusterol::write_linkage_binary(join_out, dend);
+    join_out.flush();
+  }
+
+  if(vm.count("newick-file")){
+    CLUSTEROL_PROFILE_SCOPE("write_newick_file");
+    clusterol::write_newick(newick_out, dend, digits);
+    newick_out.flush();
+  }
+
+  if(vm.count("cluster-file")){
+    // the clusters left, all of them unless stopped early
+    CLUSTEROL_PROFILE_SCOPE("write_cluster_file");
+    std::vector<size_t> label = clusterol::cut_tree(dend, dend.n_cluster());
+    if(cluster_format == "text"){
+      for(size_t i = 0; i != label.size(); ++i)
+	cluster_out << label[i] + 1 << "\n";
+      cluster_out.flush();
+    }else{
+      std::vector<int64_t> label_out(label.begin(), label.end());
+      for(size_t i = 0; i != label_out.size(); ++i)
+	++label_out[i];
+      try{
+	write_npy(cluster_filename, label_out.data(), label_out.size());
+      }catch(std::exception& e){
+	std::cerr << "An error occured during output: \n"
+		  << e.what() << "\n";
+	exit(1);
+      }
+    }
+  }
+}
+
+
+struct batch_result{
+  // output of one dataset of a batch until it is its turn
+  std::string join, cluster, error;
+  bool done;
+};
+
+
+size_t cluster_batch(const std::vector<std::string>& filename, const std::string& input_format, char separator,
+		     const std::string& metric, const std::string& method, const clusterol::cluster_options& options,
+		     const std::string& precision, const boost::program_options::variables_map& vm,
+		     std::ostream& join_out, std::ostream& cluster_out){
+  // Cluster every data-point file of a batch, the datasets are handed
+  // out one at a time to the threads, each dataset is clustered by a
+  // single thread. A thread reuses the memory of its data points, their
+  // float copy and the output buffers, the engines allocate their
+  // dissimilarity matrix and dendrogram per dataset. The join reports
+  // (and text clusters) of a dataset start with "# filename" and are
+  // written in the order of filename as soon as all datasets before
+  // are done. Returns the number of datasets that failed, their errors
+  // go to stderr.
+  CLUSTEROL_PROFILE_SCOPE("batch");
+  std::vector<batch_result> result(filename.size());
+  for(size_t i = 0; i != result.size(); ++i)
+    result[i].done = false;
+  size_t next = 0, n_failed = 0;
+  std::mutex lock;
+
+  CLUSTEROL_OMP(omp parallel)
+  {
+    // nested regions of the clustering run with one thread
+    clusterol::set_num_threads(1);
+    // reused by the datasets of this thread
+    data_matrix data;
+    std::vector<float> rows;
+    std::ostringstream join_buffer, cluster_buffer;
+    std::ofstream no_file;	// graph and newick are not written
+
+    CLUSTEROL_OMP(omp for schedule(dynamic, 1))
+    for(size_t i = 0; i < filename.size(); ++i){
+      batch_result r;
+      r.done = true;
+      clusterol::dendrogram<double> dend;
+      clusterol::dendrogram<float> dend_float;
+      try{
+	std::string format = input_format;
+	if(format == "auto")
+	  format = has_suffix(filename[i], ".npy") ? "npy" : "text";
+	if(format == "npy"){
+	  mapped_file file(filename[i]);
+	  npy_array array = parse_npy(file);
+	  if(array.word_size == 8)
+	    cluster_rows(reinterpret_cast<const double*>(array.data), array.n_row, array.n_column, metric, method,
+			 options, "", "", precision, dend, dend_float, rows);
+	  else
+	    cluster_rows(reinterpret_cast<const float*>(array.data), array.n_row, array.n_column, metric, method,
+			 options, "", "", precision, dend, dend_float, rows);
+	}else{
+	  read_data_points(filename[i], data, separator);
+	  if(data.n_row == 0)
+	    throw(std::runtime_error("No data points in " + filename[i]));
+	  cluster_rows(data.value.data(), data.n_row, data.n_column, metric, method, options, "", "",
+		       precision, dend, dend_float, rows);
+	}
+
+	join_buffer.str("");
+	cluster_buffer.str("");
+	join_buffer << "# " << filename[i] << "\n";
+	cluster_buffer << "# " << filename[i] << "\n";
+	if(precision == "double")
+	  write_results(dend, vm, no_file, join_buffer, no_file, cluster_buffer, "text", "", "text");
+	else
+	  write_results(dend_float, vm, no_file, join_buffer, no_file, cluster_buffer, "text", "", "text");
+	r.join = join_buffer.str();
+	if(vm.count("cluster-file"))
+	  r.cluster = cluster_buffer.str();
+      }catch(std::exception& e){
+	r.error = e.what();
+      }
+
+      std::lock_guard<std::mutex> guard(lock);
+      std::swap(result[i], r);
+      // write what is complete from the front
+      for(; next != result.size() && result[next].done; ++next){
+	batch_result& out = result[next];
+	if(!out.error.empty()){
+	  std::cerr << "An error occured with " << filename[next] << ": \n"
+		    << out.error << "\n";
+	  ++n_failed;
+	}
+	join_out << out.join;
+	join_out.flush();
+	cluster_out << out.cluster;
+	cluster_out.flush();
+	out = batch_result();
+	out.done = true;
+      }
+    }
+  }
+
+  return n_failed;
+}
 
 
 int main(int argc, char *argv[]){
 
-  std::string data_point_filename, label_filename, clustering_method, graph_type, graph_filename, join_filename;
+  std::string data_point_filename, input_format, dissimilarity_filename, dissimilarity_out, label_filename, metric, clustering_method,
+    graph_type, graph_filename, join_filename, join_format, newick_filename, cluster_filename, cluster_format, precision,
+    state_filename, batch_filename, linkage_filename;
   char separator;
+  int n_thread;
+  size_t memory_limit, stop_at_k;
+  double max_height;
+  bool profile;
+  clusterol::cluster_options options;
   
   namespace po = boost::program_options;
   po::options_description desc("Hierarchical Clustering with clusterol");
@@ -27,13 +420,62 @@ int main(int argc, char *argv[]){
   desc.add_options()
     ("help", "produce help message\n")
     ("data-point-file,d", po::value(&data_point_filename), "file containing the data points")
+    ("input-format", po::value(&input_format)->default_value("auto"),
+     "format of the data-point file: \"text\", \"npy\" (float32 or float64 array of shape (n, d), "
+     "memory mapped) or \"auto\" (npy for *.npy)")
+    ("batch", po::value(&batch_filename),
+     "cluster many data-point files in one run: this file lists them, one per line (empty lines and lines "
+     "starting with \"#\" are ignored). The datasets are spread over the threads, their join reports (and text "
+     "clusters) follow each other in the order of the list, each starting with \"# filename\".")
     ("separator", po::value(&separator)->default_value(' '), "separator of values in the data-point file")
+    ("dissimilarity-file", po::value(&dissimilarity_filename),
+     "cluster precomputed dissimilarities instead of data points: 1-dimensional float32 or float64 npy array "
+     "of the n(n-1)/2 upper triangle values row by row (as from scipy's pdist), memory mapped")
+    ("read-linkage", po::value(&linkage_filename),
+     "instead of clustering, read the dendrogram from a binary join-file (--join-format binary, heights as "
+     "--precision) and write it in the requested formats")
+    ("write-dissimilarities", po::value(&dissimilarity_out),
+     "write the dissimilarities of the data points to this file (npy, for --dissimilarity-file)")
+    ("metric", po::value(&metric)->default_value("euclidean"),
+     "dissimilarity of data points: \"euclidean\", \"squared-euclidean\", \"manhattan\", \"chebyshev\", "
+     "\"cosine\" or \"hamming\" (number of different values, 0/1 data is compared as packed bits)")
     // currently labels 1..N are used by default
     // ("label-file,l", po::value(&label_filename), "file containing labels")
-    ("method,m", po::value(&clustering_method)->default_value("single-link"), "available methods are \"single\"") // and many more
+    ("method,m", po::value(&clustering_method)->default_value("single-link"),
+     "available methods are \"single-link\", \"single-link-kdtree\" (Euclidean only), \"complete-link\", \"ward\", \"group-average\", "
+     "\"weighted-group-average\", \"centroid\", \"median\" and the dissimilarity matrix "
+     "variants \"matrix-single-link\", \"matrix-complete-link\", \"matrix-ward\", "
+     "\"matrix-group-average\", \"matrix-weighted-group-average\", \"matrix-centroid\", \"matrix-median\" "
+     "and for Euclidean data points without a dissimilarity matrix \"geometric-ward\", \"geometric-centroid\", "
+     "\"geometric-median\" (heights as with --metric squared-euclidean)")
     ("graph-type", po::value(&graph_type)->default_value("graphviz"), "available types are \"graphviz\"") // and \"graphml\"
     ("graph-file", po::value(&graph_filename), "write graph in specified format to this file")
     ("join-file", po::value(&join_filename)->default_value("-"), "put information about mergers/joins here")
+    ("join-format", po::value(&join_format)->default_value("text"),
+     "format of the join-file: \"text\" (as R's hclust$merge and $height) or \"binary\" (a line "
+     "\"clusterol-linkage n n_merge height_bytes\", then per merge uint32 vertex ids 0..2n-2 and the height)")
+    ("newick-file", po::value(&newick_filename), "write the dendrogram in Newick format here (one tree per cluster left)")
+    ("stop-at-k", po::value(&stop_at_k)->default_value(1),
+     "stop clustering when this many clusters are left, the join-file then has only the merges up to there")
+    ("max-height", po::value(&max_height)->default_value(std::numeric_limits<double>::infinity(), "inf"),
+     "stop clustering before the first merge higher than this")
+    ("state-file", po::value(&state_filename),
+     "single link with this state of earlier runs: only the data points after those of the last run (the data-point-file "
+     "must start with them) are added to its minimum spanning tree, then the state is updated. A missing file starts anew.")
+    ("cluster-file", po::value(&cluster_filename),
+     "write the cluster (1, 2, ... by first data point, as R's cutree) of every data point after the last merge here")
+    ("cluster-format", po::value(&cluster_format)->default_value("text"),
+     "format of the cluster-file: \"text\" (one per line) or \"npy\" (int64 array)")
+    ("precision", po::value(&precision)->default_value("double"),
+     "\"double\", \"float\" (data points, dissimilarity matrix and heights in single precision: half the memory and "
+     "bandwidth, about 7 digits) or \"mixed\" (float, but distances are summed up in double)")
+    ("threads", po::value(&n_thread)->default_value(0), "number of threads, 0 uses all cores")
+    ("memory-limit", po::value(&memory_limit)->default_value(0),
+     "megabytes for the dissimilarity matrix, a larger matrix is kept in a scratch file (0: no limit)")
+    ("scratch-dir", po::value(&options.scratch_dir), "directory for the scratch file, default $TMPDIR or /tmp")
+    ("profile", po::bool_switch(&profile),
+     "print wall time and calls of the phases (parsing, distances, joins, output, ...) and counters (distance calls, "
+     "Lance-Williams evaluations, allocated bytes, ...) as JSON to stderr at the end")
     ;
 
   po::variables_map vm;
@@ -52,21 +494,89 @@ int main(int argc, char *argv[]){
   }
 
   // sanity-checks
-  if(!vm.count("data-point-file")){
+  size_t n_input = vm.count("data-point-file") + vm.count("dissimilarity-file") + vm.count("batch") + vm.count("read-linkage");
+  if(n_input == 0){
     std::cerr << "No data-point-file given\n";
     exit(1);
   }
+  if(n_input > 1){
+    std::cerr << "Give either a data-point-file, a dissimilarity-file, a batch or a linkage to read\n";
+    exit(1);
+  }
+  if((vm.count("dissimilarity-file") || vm.count("read-linkage")) && vm.count("write-dissimilarities")){
+    std::cerr << "write-dissimilarities needs a data-point-file\n";
+    exit(1);
+  }
+  if(vm.count("batch") && (!graph_filename.empty() || !newick_filename.empty() || !dissimilarity_out.empty()
+			   || !state_filename.empty() || join_format != "text" || cluster_format != "text")){
+    std::cerr << "batch writes neither graph-file, newick-file, write-dissimilarities, state-file nor binary joins "
+	      << "or npy clusters\n";
+    exit(1);
+  }
+  // a batch decides on "auto" per file
+  if(input_format == "auto" && !vm.count("batch"))
+    input_format = has_suffix(data_point_filename, ".npy") ? "npy" : "text";
+  if(input_format != "auto" && input_format != "text" && input_format != "npy"){
+    std::cerr << "Unsupported input-format: " << input_format << "\n";
+    exit(1);
+  }
+  if(std::find(std::begin(metric_names), std::end(metric_names), metric) == std::end(metric_names)){
+    std::cerr << "Unsupported metric: " << metric << "\n";
+    exit(1);
+  }
+  if(join_format != "text" && join_format != "binary"){
+    std::cerr << "Unsupported join-format: " << join_format << "\n";
+    exit(1);
+  }
+  if(std::find(std::begin(clusterol::method_names), std::end(clusterol::method_names), clustering_method)
+     == std::end(clusterol::method_names)){
+    std::cerr << "Unsupported method: " << clustering_method << "\n";
+    exit(1);
+  }
+  if(needs_data_points(clustering_method) && (vm.count("dissimilarity-file") || metric != "euclidean")){
+    std::cerr << clustering_method << " needs data points and the euclidean metric\n";
+    exit(1);
+  }
+  if(cluster_format != "text" && cluster_format != "npy"){
+    std::cerr << "Unsupported cluster-format: " << cluster_format << "\n";
+    exit(1);
+  }
+  if(!state_filename.empty() && (clustering_method != "single-link" || !dissimilarity_filename.empty() || !linkage_filename.empty()
+				 || !dissimilarity_out.empty())){
+    std::cerr << "state-file needs method single-link, data points and no write-dissimilarities\n";
+    exit(1);
+  }
+  if(precision != "double" && precision != "float" && precision != "mixed"){
+    std::cerr << "Unsupported precision: " << precision << "\n";
+    exit(1);
+  }
+#ifndef CLUSTEROL_PROFILE
+  if(profile){
+    std::cerr << "--profile needs a build with CLUSTEROL_PROFILE\n";
+    exit(1);
+  }
+#endif
   if(graph_type != "graphviz"){
     std::cerr << "Unsupported graph-type: " << graph_type << "\n";
     exit(1);
   }
 
 
+  clusterol::set_num_threads(n_thread);
+  if(profile)
+    clusterol::profile::enable();
+  options.memory_limit = memory_limit << 20;
+  options.stop = clusterol::stop_criterion(stop_at_k, max_height);
+
   // open output files
-  std::ofstream graph_out, join_out;
+  std::ofstream graph_out, join_out, newick_out, cluster_out;
   try{
     if(!graph_filename.empty())
       open_outfile(graph_filename, graph_out);
+    if(!newick_filename.empty())
+      open_outfile(newick_filename, newick_out);
+    if(!cluster_filename.empty() && cluster_format == "text")
+      open_outfile(cluster_filename, cluster_out);
     if(!join_filename.empty())		// always open, suppress with ""
       open_outfile(join_filename, join_out);
   }catch(std::exception& e){
@@ -75,39 +585,122 @@ int main(int argc, char *argv[]){
     exit(1);
   }
   
-  // Input
-  // support only one data_point-type
-  typedef std::vector<double> data_point;
-  std::vector<std::string> line;
-  std::vector<data_point> data_set;
+  if(vm.count("batch")){
+    std::vector<std::string> manifest;
+    try{
+      std::vector<std::string> line = read_file(batch_filename);
+      for(size_t i = 0; i != line.size(); ++i)
+	if(!line[i].empty())
+	  manifest.push_back(line[i]);
+    }catch(std::exception& e){
+      std::cerr << "An error occured during input: \n"
+		<< e.what() << "\n";
+      exit(1);
+    }
 
+    size_t n_failed = cluster_batch(manifest, input_format, separator, metric, clustering_method, options, precision, vm,
+				    join_out, cluster_out);
+    if(profile)
+      clusterol::profile::write_json(std::cerr);
+    return n_failed == 0 ? 0 : 1;
+  }
+
+  // Input and clustering
+  // both formats end up as rows of values, npy is used in place unless
+  // double values are needed as float
+  clusterol::dendrogram<double> dend;
+  clusterol::dendrogram<float> dend_float;
+  std::vector<float> rows;
   try{
-    line = read_file(data_point_filename);
-    data_set = lines_to_data_points(line, separator);
+    if(!linkage_filename.empty()){
+      // a dendrogram written before, nothing to cluster
+      try{
+	std::ifstream in(linkage_filename.c_str(), std::ios::binary);
+	if(!in.is_open())
+	  throw(std::runtime_error("Could not open " + linkage_filename));
+	if(precision == "double")
+	  dend = clusterol::read_linkage_binary<double>(in);
+	else
+	  dend_float = clusterol::read_linkage_binary<float>(in);
+      }catch(std::exception& e){
+	std::cerr << "An error occured during input: \n"
+		  << e.what() << "\n";
+	exit(1);
+      }
+    }else if(!dissimilarity_filename.empty()){
+      std::unique_ptr<mapped_file> file;
+      npy_array array;
+      size_t n = 0;
+      try{
+	file.reset(new mapped_file(dissimilarity_filename));
+	array = parse_npy(*file);
+	if(array.n_dim != 1 || !(n = clusterol::condensed_size_to_n(array.n_row)))
+	  throw(std::runtime_error("dissimilarity-file must contain n(n-1)/2 values for some n > 1"));
+      }catch(std::exception& e){
+	std::cerr << "An error occured during input: \n"
+		  << e.what() << "\n";
+	exit(1);
+      }
+
+      // float heights read double dissimilarities in place, rounding
+      // each once
+      if(array.word_size == 8 && precision == "double")
+	dend = cluster_dissimilarities<double>(reinterpret_cast<const double*>(array.data), n, clustering_method, options);
+      else if(precision == "double")
+	dend = cluster_dissimilarities<double>(reinterpret_cast<const float*>(array.data), n, clustering_method, options);
+      else if(array.word_size == 8)
+	dend_float = cluster_dissimilarities<float>(reinterpret_cast<const double*>(array.data), n, clustering_method, options);
+      else
+	dend_float = cluster_dissimilarities<float>(reinterpret_cast<const float*>(array.data), n, clustering_method, options);
+    }else if(input_format == "npy"){
+      // the mapping must outlive the clustering
+      std::unique_ptr<mapped_file> file;
+      npy_array array;
+      try{
+	file.reset(new mapped_file(data_point_filename));
+	array = parse_npy(*file);
+      }catch(std::exception& e){
+	std::cerr << "An error occured during input: \n"
+		  << e.what() << "\n";
+	exit(1);
+      }
+
+      if(array.word_size == 8)
+	cluster_rows(reinterpret_cast<const double*>(array.data), array.n_row, array.n_column, metric, clustering_method,
+		     options, dissimilarity_out, state_filename, precision, dend, dend_float, rows);
+      else
+	cluster_rows(reinterpret_cast<const float*>(array.data), array.n_row, array.n_column, metric, clustering_method,
+		     options, dissimilarity_out, state_filename, precision, dend, dend_float, rows);
+    }else{
+      data_matrix data;
+      try{
+	data = read_data_points(data_point_filename, separator);
+	if(data.n_row == 0)
+	  throw(std::runtime_error("No data points in " + data_point_filename));
+      }catch(std::exception& e){
+	std::cerr << "An error occured during input: \n"
+		  << e.what() << "\n";
+	exit(1);
+      }
+
+      cluster_rows(data.value.data(), data.n_row, data.n_column, metric, clustering_method, options, dissimilarity_out,
+		   state_filename, precision, dend, dend_float, rows);
+    }
   }catch(std::exception& e){
-    std::cerr << "An error occured during input: \n"
+    std::cerr << "An error occured during clustering: \n"
 	      << e.what() << "\n";
     exit(1);
   }
-
-  // clustering, clusterol::cluster checks if clustering_method is available
-  clusterol::dendrogram<> dend = clusterol::cluster<double>(data_set.begin(), data_set.end(), clustering_method,
-							    clusterol::dissimilarity_be<clusterol::euclidean_distance>());
   
-  if(vm.count("graph-file"))
-    boost::write_graphviz(graph_out, dend.tree, boost::make_label_writer(&dend.height[0]));
+  if(precision == "double")
+    write_results(dend, vm, graph_out, join_out, newick_out, cluster_out, join_format, cluster_filename,
+		  cluster_format);
+  else
+    write_results(dend_float, vm, graph_out, join_out, newick_out, cluster_out, join_format, cluster_filename,
+		  cluster_format);
+
+  if(profile)
+    clusterol::profile::write_json(std::cerr);
 
-  if(vm.count("join-file")){
-    typedef typename clusterol::dendrogram<>::join_report_entry_type join_report_entry_type;
-    std::vector<join_report_entry_type> join_report = clusterol::get_join_report<join_report_entry_type>(dend.tree, &dend.height[0]);
-    sort(join_report.begin(), join_report.end());
-    
-    for(std::vector<join_report_entry_type>::iterator i = join_report.begin(); i != join_report.end(); ++i)
-      join_out << clusterol::vertex_descriptor_to_R(i->pair.first, data_set.size())
-	       << " " << clusterol::vertex_descriptor_to_R(i->pair.second, data_set.size())
-	       << " " << std::setprecision(15) << i->height
-	       << "\n";
-  }
-  
   return 0;
 }
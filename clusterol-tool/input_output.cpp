@@ -3,6 +3,14 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <charconv>
+#include <cstring>
+#include "clusterol/parallel.hpp"
+#include "clusterol/profile.hpp"
 
 
 void open_outfile(const std::string& filename, std::ofstream& ofs){
@@ -21,6 +29,7 @@ std::vector<std::string> read_file(const std::string& filename, size_t skip){
   // read lines from filename into a vector of strings,
   // ignore lines commented with "#"
   // skip first skip lines to ignore headers
+  CLUSTEROL_PROFILE_SCOPE("read_file");
   
   std::ifstream file(filename.c_str());
   if(!file.good())
@@ -41,49 +50,388 @@ std::vector<std::string> read_file(const std::string& filename, size_t skip){
 }
 
 
-std::vector< std::vector<double> > lines_to_data_points(const std::vector<std::string>& line, char separator){
-  // convert vector of lines to vector of data points, which are
-  // vector<double>.
-  // There is simple support for separators, which
-  // works by replacing the separator with ' '.
+namespace{
+  // files are parsed in chunks of about this many bytes
+  const size_t parse_chunk = 1 << 20;
 
-  if(line.size() == 0)
-    return std::vector< std::vector<double> >();
+  enum line_status {line_ok, line_unreadable, line_too_long};
 
-  size_t data_point_size = 0;
-  double tmp;
-  std::string l = line[0];
-  std::replace(l.begin(), l.end(), separator, ' ');
-  std::stringstream ss(l);
-  while(ss >> tmp)
-    ++data_point_size;
-  if(ss.fail() && !ss.eof())
-    throw(std::runtime_error("Could not convert data points from strings"));
-  if(data_point_size == 0)
+
+  bool is_blank(char c, char separator){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == separator;
+  }
+
+
+  const char* line_end(const char* p, const char* end){
+    const char* q = static_cast<const char*>(memchr(p, '\n', end - p));
+    return q ? q : end;
+  }
+
+
+  const char* next_line(const char* p, const char* end){
+    p = line_end(p, end);
+    return p == end ? end : p + 1;
+  }
+
+
+  const char* parse_value(const char* p, const char* end, char separator, double& x){
+    // parse a value at p, return the end of the value or 0
+    if(p != end && *p == '+' && p + 1 != end && p[1] != '-')
+      ++p;			// from_chars doesn't accept '+'
+    std::from_chars_result r = std::from_chars(p, end, x);
+    if(r.ec != std::errc() || (r.ptr != end && !is_blank(*r.ptr, separator)))
+      return 0;
+    return r.ptr;
+  }
+
+
+  line_status parse_line(const char* p, const char* end, char separator, double* out, size_t n_column){
+    // read exactly n_column values from the line [p, end)
+    for(size_t j = 0; j != n_column; ++j){
+      while(p != end && is_blank(*p, separator))
+	++p;
+      if(p == end || !(p = parse_value(p, end, separator, out[j])))
+	return line_unreadable;
+    }
+    while(p != end && is_blank(*p, separator))
+      ++p;
+    return p == end ? line_ok : line_too_long;
+  }
+
+
+  struct chunk_info{
+    const char* begin;
+    const char* end;
+    size_t first_line;		// index of the first data line
+    size_t error_line;		// first line with an error or npos
+    line_status error;
+    const char* error_begin;
+    const char* error_end;
+  };
+}
+
+
+data_matrix read_data_points(const std::string& filename, char separator, size_t skip){
+  data_matrix data;
+  read_data_points(filename, data, separator, skip);
+  return data;
+}
+
+
+void read_data_points(const std::string& filename, data_matrix& data, char separator, size_t skip){
+  // Read data points from a text file into data (its memory is reused),
+  // one per line with values
+  // separated by whitespace or separator. Lines starting with "#" are
+  // ignored, the first skip lines are skipped to ignore headers.
+  // The file is mapped and cut into chunks at line boundaries, the
+  // chunks are counted and then parsed in parallel into one array.
+  // Errors report the number of the data line like read_file and
+  // lines_to_data_points did.
+  CLUSTEROL_PROFILE_SCOPE("read_data_points");
+  const size_t npos = size_t(-1);
+
+  mapped_file file(filename);
+  const char* begin = file.data();
+  const char* end = begin + file.size();
+  for(size_t i = 0; i != skip && begin != end; ++i)
+    begin = next_line(begin, end);
+
+  data.value.clear();
+  data.n_row = 0;
+  data.n_column = 0;
+
+  // the first data line determines the size of a data point
+  const char* first = begin;
+  while(first != end && *first == '#')
+    first = next_line(first, end);
+  if(first == end)
+    return;
+
+  const char* first_end = line_end(first, end);
+  for(const char* p = first;;){
+    while(p != first_end && is_blank(*p, separator))
+      ++p;
+    if(p == first_end)
+      break;
+    double tmp;
+    if(!(p = parse_value(p, first_end, separator, tmp)))
+      throw(std::runtime_error("Could not convert data points from strings"));
+    ++data.n_column;
+  }
+  if(data.n_column == 0)
     throw(std::runtime_error("Size of first data point is apparently 0"));
 
-  
-  std::vector< std::vector<double> > data_set(line.size(), std::vector<double>(data_point_size));
-
-  for(size_t i = 0; i != line.size(); ++i){
-    std::stringstream ss;
-    if(separator == ' '){
-      ss.str(line[i]);
-    }else{
-      std::string l = line[i];
-      std::replace(l.begin(), l.end(), separator, ' ');
-      ss.str(l);
+  // chunks start at the beginning of a line
+  size_t n_chunk = std::max<size_t>(1, (end - first) / parse_chunk);
+  std::vector<chunk_info> chunk(n_chunk);
+  for(size_t c = 0; c != n_chunk; ++c){
+    const char* p = first + (end - first) * c / n_chunk;
+    if(c == 0)
+      p = first;
+    else if(p[-1] != '\n')
+      p = next_line(p, end);
+    chunk[c].begin = std::max(p, c > 0 ? chunk[c - 1].begin : first);
+    chunk[c].error_line = npos;
+  }
+  for(size_t c = 0; c != n_chunk; ++c)
+    chunk[c].end = c + 1 < n_chunk ? chunk[c + 1].begin : end;
+
+  // count data lines
+  CLUSTEROL_OMP(omp parallel for schedule(dynamic))
+  for(size_t c = 0; c < n_chunk; ++c){
+    size_t n_line = 0;
+    for(const char* p = chunk[c].begin; p != chunk[c].end; p = next_line(p, chunk[c].end))
+      if(*p != '#')
+	++n_line;
+    chunk[c].first_line = n_line;
+  }
+  for(size_t c = 0; c != n_chunk; ++c){
+    size_t n_line = chunk[c].first_line;
+    chunk[c].first_line = data.n_row;
+    data.n_row += n_line;
+  }
+
+  // parse, every chunk stops at its first error
+  data.value.resize(data.n_row * data.n_column);
+  CLUSTEROL_OMP(omp parallel for schedule(dynamic))
+  for(size_t c = 0; c < n_chunk; ++c){
+    size_t i = chunk[c].first_line;
+    for(const char* p = chunk[c].begin; p != chunk[c].end; p = next_line(p, chunk[c].end)){
+      if(*p == '#')
+	continue;
+      const char* p_end = line_end(p, chunk[c].end);
+      line_status status = parse_line(p, p_end, separator, &data.value[i * data.n_column], data.n_column);
+      if(status != line_ok){
+	chunk[c].error_line = i;
+	chunk[c].error = status;
+	chunk[c].error_begin = p;
+	chunk[c].error_end = p_end;
+	break;
+      }
+      ++i;
+    }
+  }
+
+  for(size_t c = 0; c != n_chunk; ++c){
+    if(chunk[c].error_line == npos)
+      continue;
+    std::string line_number = x_to_string(chunk[c].error_line + 1);
+    if(chunk[c].error == line_unreadable)
+      throw(std::runtime_error(std::string("Could not read data point on line ") + line_number));
+
+    std::string l(chunk[c].error_begin, chunk[c].error_end);
+    std::replace(l.begin(), l.end(), separator, ' ');
+    throw(std::runtime_error(std::string("Data point on line ") + line_number +
+			     std::string(" is too long:\n") + l +
+			     std::string("\nexpected: ") +  x_to_string(data.n_column) + std::string("\n")));
+  }
+
+  CLUSTEROL_PROFILE_COUNT("allocated_bytes.data_points", data.value.size() * sizeof(double));
+}
+
+
+bool has_suffix(const std::string& s, const std::string& suffix){
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+mapped_file::mapped_file(const std::string& filename)
+  : begin(0),
+    length(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd == -1)
+    throw(std::runtime_error("Could not open file " + filename));
+
+  struct stat st;
+  if(fstat(fd, &st) == -1){
+    close(fd);
+    throw(std::runtime_error("Could not stat file " + filename));
+  }
+
+  length = st.st_size;
+  if(length > 0){
+    void* p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED){
+      close(fd);
+      throw(std::runtime_error("Could not map file " + filename));
     }
-      
-    for(size_t j = 0; j != data_point_size; ++j){
-      if(!(ss >> data_set[i][j]))      
-	throw(std::runtime_error(std::string("Could not read data point on line ") + x_to_string(i + 1)));
+    begin = static_cast<const char*>(p);
+  }
+  close(fd);			// the mapping stays valid
+}
+
+
+mapped_file::~mapped_file(){
+  if(begin)
+    munmap(const_cast<char*>(begin), length);
+}
+
+
+namespace{
+  std::string npy_value(const std::string& header, const std::string& key){
+    // value of key in the python dict literal header, up to the next
+    // ',' outside of parentheses
+    size_t pos = header.find("'" + key + "'");
+    if(pos == std::string::npos)
+      throw(std::runtime_error("npy header has no " + key));
+    pos = header.find(':', pos);
+    if(pos == std::string::npos)
+      throw(std::runtime_error("Malformed npy header"));
+
+    size_t end = pos + 1;
+    int depth = 0;
+    for(; end < header.size(); ++end){
+      char c = header[end];
+      if(c == '(')
+	++depth;
+      else if(c == ')')
+	--depth;
+      else if(depth == 0 && (c == ',' || c == '}'))
+	break;
     }
-    if(!ss.eof())
-      throw(std::runtime_error(std::string("Data point on line ") + x_to_string(i + 1) +
-			       std::string(" is too long:\n") + ss.str() +
-			       std::string("\nexpected: ") +  x_to_string(data_point_size) + std::string("\n")));
+
+    std::string value = header.substr(pos + 1, end - pos - 1);
+    value.erase(std::remove(value.begin(), value.end(), ' '), value.end());
+    return value;
+  }
+}
+
+
+npy_array parse_npy(const mapped_file& file){
+  // parse the header of a .npy file (format versions 1 to 3), see
+  // numpy.lib.format. Only 1- and 2-dimensional float32 and float64
+  // arrays in C order are supported.
+  CLUSTEROL_PROFILE_SCOPE("parse_npy");
+  const char* p = file.data();
+  size_t size = file.size();
+  if(size < 10 || std::string(p, 6) != "\x93NUMPY")
+    throw(std::runtime_error("Not a npy file"));
+
+  unsigned char major = p[6];
+  size_t header_begin, header_length;
+  if(major == 1){
+    header_begin = 10;
+    header_length = (unsigned char) p[8] | (size_t((unsigned char) p[9]) << 8);
+  }else if(major == 2 || major == 3){
+    if(size < 12)
+      throw(std::runtime_error("Truncated npy file"));
+    header_begin = 12;
+    header_length = 0;
+    for(size_t i = 0; i != 4; ++i)
+      header_length |= size_t((unsigned char) p[8 + i]) << (8 * i);
+  }else{
+    throw(std::runtime_error("Unsupported npy version " + x_to_string(int(major))));
+  }
+  if(header_begin + header_length > size)
+    throw(std::runtime_error("Truncated npy file"));
+
+  std::string header(p + header_begin, header_length);
+  npy_array array;
+  array.data = p + header_begin + header_length;
+
+  std::string descr = npy_value(header, "descr");
+  if(descr == "'<f8'")
+    array.word_size = 8;
+  else if(descr == "'<f4'")
+    array.word_size = 4;
+  else
+    throw(std::runtime_error("Unsupported npy dtype " + descr + ", expected '<f4' or '<f8'"));
+
+  if(npy_value(header, "fortran_order") != "False")
+    throw(std::runtime_error("npy arrays in Fortran order are not supported"));
+
+  std::string shape = npy_value(header, "shape");
+  std::replace(shape.begin(), shape.end(), '(', ' ');
+  std::replace(shape.begin(), shape.end(), ')', ' ');
+  std::replace(shape.begin(), shape.end(), ',', ' ');
+  std::stringstream ss(shape);
+  std::vector<size_t> dim;
+  size_t d;
+  while(ss >> d)
+    dim.push_back(d);
+  array.n_dim = dim.size();
+  if(dim.size() == 1)
+    dim.push_back(1);
+  if(dim.size() != 2 || dim[0] == 0 || dim[1] == 0)
+    throw(std::runtime_error("npy array must have shape (n,) or (n, d) with n, d > 0"));
+  array.n_row = dim[0];
+  array.n_column = dim[1];
+
+  if(size - header_begin - header_length < array.n_row * array.n_column * array.word_size)
+    throw(std::runtime_error("Truncated npy file"));
+  if(reinterpret_cast<size_t>(array.data) % array.word_size != 0)
+    throw(std::runtime_error("Misaligned npy data"));
+
+  return array;
+}
+
+
+npy_writer::npy_writer(const std::string& filename_, const std::string& descr, size_t word_size_, size_t n)
+  : filename(filename_), word_size(word_size_), n_left(n)
+{
+  // the header of a 1-dimensional .npy file (version 1) of n values
+  std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" + x_to_string(n) + ",), }";
+  // magic, version and length take 10 bytes, the data starts at a
+  // multiple of 64 after a '\n'
+  header.append(63 - (10 + header.size()) % 64, ' ');
+  header += '\n';
+
+  file.open(filename.c_str(), std::ios::binary);
+  if(!file.is_open())
+    throw(std::runtime_error("Could not open " + filename));
+  file.write("\x93NUMPY\x01\x00", 8);
+  char length[2] = {char(header.size() & 0xff), char(header.size() >> 8)};
+  file.write(length, 2);
+  file << header;
+}
+
+
+void npy_writer::write(const void* value, size_t k){
+  // the next k values, assumes a little-endian machine like parse_npy
+  if(k > n_left)
+    throw(std::runtime_error("Too many values for " + filename));
+  file.write(static_cast<const char*>(value), k * word_size);
+  n_left -= k;
+  if(!file.good())
+    throw(std::runtime_error("Could not write " + filename));
+}
+
+
+void npy_writer::close(){
+  // all n values must have been written
+  if(n_left != 0)
+    throw(std::runtime_error("Too few values for " + filename));
+  file.close();
+  if(!file.good())
+    throw(std::runtime_error("Could not write " + filename));
+}
+
+
+namespace{
+  void write_npy(const std::string& filename, const std::string& descr, const char* value, size_t n, size_t word_size){
+    // write n values as a 1-dimensional .npy file
+    CLUSTEROL_PROFILE_SCOPE("write_npy");
+    npy_writer file(filename, descr, word_size, n);
+    file.write(value, n);
+    file.close();
   }
+}
+
+
+void write_npy(const std::string& filename, const double* value, size_t n){
+  // float64 values
+  write_npy(filename, "<f8", reinterpret_cast<const char*>(value), n, sizeof(double));
+}
+
+
+void write_npy(const std::string& filename, const float* value, size_t n){
+  // float32 values
+  write_npy(filename, "<f4", reinterpret_cast<const char*>(value), n, sizeof(float));
+}
+
 
-  return data_set;
+void write_npy(const std::string& filename, const int64_t* value, size_t n){
+  // int64 values, e.g. cluster labels
+  write_npy(filename, "<i8", reinterpret_cast<const char*>(value), n, sizeof(int64_t));
 }
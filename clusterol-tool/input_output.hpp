@@ -2,15 +2,80 @@
 #define _INPUT_OUTPUT_H_
 
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 
 // helper functions for reading and writing files
 
 void open_outfile(const std::string& filename, std::ofstream& ofs);
 std::vector<std::string> read_file(const std::string& filename, size_t skip=0);
-std::vector< std::vector<double> > lines_to_data_points(const std::vector<std::string>& line, char separator=' ');
+
+struct data_matrix{
+  // data points row by row in one array
+  std::vector<double> value;
+  size_t n_row, n_column;
+};
+
+data_matrix read_data_points(const std::string& filename, char separator=' ', size_t skip=0);
+void read_data_points(const std::string& filename, data_matrix& data, char separator=' ', size_t skip=0);
+bool has_suffix(const std::string& s, const std::string& suffix);
+
+
+class mapped_file{
+  // read-only memory map of a whole file, unmapped by the destructor
+public:
+  mapped_file(const std::string& filename);
+  ~mapped_file();
+
+  const char* data() const{
+    return begin;
+  }
+
+  size_t size() const{
+    return length;
+  }
+
+private:
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+
+  const char* begin;
+  size_t length;
+};
+
+
+struct npy_array{
+  // a 1- or 2-dimensional, C ordered .npy array of little-endian
+  // floating point values inside a mapped_file
+  const char* data;
+  size_t word_size;		// 4: float32, 8: float64
+  size_t n_dim;			// 1: shape (n_row,) and n_column = 1
+  size_t n_row, n_column;
+};
+
+npy_array parse_npy(const mapped_file& file);
+void write_npy(const std::string& filename, const double* value, size_t n);
+void write_npy(const std::string& filename, const float* value, size_t n);
+void write_npy(const std::string& filename, const int64_t* value, size_t n);
+
+
+class npy_writer{
+  // A 1-dimensional .npy file of n values written in parts, e.g. more
+  // than fit into memory at once. descr is the numpy type of the values
+  // ("<f8", "<f4", "<i8"), word_size their size in bytes.
+public:
+  npy_writer(const std::string& filename, const std::string& descr, size_t word_size, size_t n);
+  void write(const void* value, size_t k);
+  void close();
+
+private:
+  std::ofstream file;
+  std::string filename;
+  size_t word_size, n_left;
+};
 
 template<typename T>
 std::string x_to_string(const T& x){
@@ -0,0 +1,256 @@
+#ifndef _CLUSTEROL_BORUVKA_H_
+#define _CLUSTEROL_BORUVKA_H_
+
+#include "dendrogram.hpp"
+#include "kd_tree.hpp"
+#include "kernels.hpp"
+#include "minimum_spanning_tree.hpp"
+#include "profile.hpp"
+#include <boost/graph/adjacency_list.hpp>
+#include <boost/graph/graph_traits.hpp>
+#include <boost/pending/disjoint_sets.hpp>
+#include <vector>
+#include <limits>
+#include <cmath>
+
+
+// Exact Euclidean minimum spanning tree with dual-tree Boruvka on a
+// kd-tree and the related single-link algorithm.
+// Every Boruvka round finds the shortest edge leaving each component
+// by a simultaneous traversal of the kd-tree with itself. Node pairs
+// are pruned if both nodes lie in the same component or if their
+// boxes are farther apart than the worst current candidate of the
+// query node. Edges are ordered by (weight, vertex, vertex), so ties
+// can't create cycles. The number of components at least halves per
+// round, in low dimensions a round takes about O(n log n). The points
+// of a leaf with equal coordinates (duplicates) are joined by edges of
+// weight 0 first, then the first of them stands for the whole leaf.
+// Lit: March, Ram, Gray, "Fast Euclidean minimum spanning tree:
+// algorithm, analysis, and applications", KDD 2010.
+
+namespace clusterol{
+
+  template <typename coordinate_type = double>
+  class dual_tree_boruvka{
+  public:
+    typedef kd_tree<coordinate_type> tree_type;
+    typedef weighted_edge<size_t, coordinate_type> edge_type;
+
+    dual_tree_boruvka(const tree_type& tree_)
+      : tree(tree_),
+	comp(tree.size()),
+	node_comp(tree.n_node()),
+	node_bound(tree.n_node()),
+	best_weight(tree.size()),
+	best_source(tree.size()),
+	best_target(tree.size())
+    {}
+
+    void run(std::vector<edge_type>& edge);
+
+  private:
+    static const size_t npos = size_t(-1);
+
+    bool better(coordinate_type w, size_t a, size_t b, size_t c) const{
+      // is (w, a, b) a shorter edge than the best one of component c?
+      if(best_source[c] == npos || w < best_weight[c])
+	return true;
+      if(w > best_weight[c])
+	return false;
+      size_t lo = std::min(a, b), hi = std::max(a, b);
+      size_t best_lo = std::min(best_source[c], best_target[c]);
+      size_t best_hi = std::max(best_source[c], best_target[c]);
+      return lo < best_lo || (lo == best_lo && hi < best_hi);
+    }
+
+    void find_node_components();
+    void dual(size_t q, size_t r);
+
+    const tree_type& tree;
+    std::vector<size_t> comp;			// point -> representative
+    std::vector<size_t> node_comp;		// node -> component or npos
+    std::vector<coordinate_type> node_bound;	// node -> worst candidate
+    // shortest edge leaving a component, indexed by representative
+    std::vector<coordinate_type> best_weight;
+    std::vector<size_t> best_source, best_target;
+  };
+
+
+  template <typename coordinate_type>
+  const size_t dual_tree_boruvka<coordinate_type>::npos;
+
+
+  template <typename coordinate_type>
+  void dual_tree_boruvka<coordinate_type>::run(std::vector<edge_type>& edge){
+    // Append the n-1 edges of the MST to edge, vertices are positions
+    // in the tree, weights are squared distances.
+    size_t n = tree.size();
+    boost::disjoint_sets_with_storage<> dis_sets(n);
+    for(size_t i = 0; i != n; ++i)
+      dis_sets.make_set(i);
+
+    size_t n_edge = 0;
+    for(size_t i = 0; i != tree.n_node(); ++i){
+      if(!tree[i].all_equal)
+	continue;
+      for(size_t k = tree[i].begin + 1; k < tree[i].end; ++k){
+	dis_sets.union_set(tree[i].begin, k);
+	edge.push_back((edge_type) {tree[i].begin, k, coordinate_type(0)});
+	++n_edge;
+      }
+    }
+    for(size_t i = 0; i != n; ++i)
+      comp[i] = dis_sets.find_set(i);
+
+    while(n_edge + 1 < n){
+      std::fill(best_source.begin(), best_source.end(), npos);
+      std::fill(node_bound.begin(), node_bound.end(), std::numeric_limits<coordinate_type>::max());
+      find_node_components();
+
+      dual(0, 0);
+
+      for(size_t c = 0; c != n; ++c){
+	if(comp[c] != c || best_source[c] == npos)
+	  continue;
+	size_t rep_s = dis_sets.find_set(best_source[c]);
+	size_t rep_t = dis_sets.find_set(best_target[c]);
+	if(rep_s == rep_t)
+	  continue;		// found by both components
+	dis_sets.link(rep_s, rep_t);
+	edge.push_back((edge_type) {best_source[c], best_target[c], best_weight[c]});
+	++n_edge;
+      }
+
+      for(size_t i = 0; i != n; ++i)
+	comp[i] = dis_sets.find_set(i);
+    }
+  }
+
+
+  template <typename coordinate_type>
+  void dual_tree_boruvka<coordinate_type>::find_node_components(){
+    // children have larger indices than their parents
+    for(size_t i = tree.n_node(); i-- > 0;){
+      if(tree.is_leaf(i)){
+	node_comp[i] = comp[tree[i].begin];
+	for(size_t k = tree[i].begin + 1; k < tree[i].end; ++k)
+	  if(comp[k] != node_comp[i]){
+	    node_comp[i] = npos;
+	    break;
+	  }
+      }else{
+	size_t left = node_comp[tree[i].left];
+	node_comp[i] = left == node_comp[tree[i].right] ? left : npos;
+      }
+    }
+  }
+
+
+  template <typename coordinate_type>
+  void dual_tree_boruvka<coordinate_type>::dual(size_t q, size_t r){
+    // improve the candidates of the points in q with points in r
+    if(node_comp[q] != npos && node_comp[q] == node_comp[r])
+      return;
+    if(tree.box_distance2(q, r) > node_bound[q])
+      return;
+
+    if(tree.is_leaf(q) && tree.is_leaf(r)){
+      // only the first point of a leaf of duplicates
+      size_t q_end = tree[q].all_equal ? tree[q].begin + 1 : tree[q].end;
+      size_t r_end = tree[r].all_equal ? tree[r].begin + 1 : tree[r].end;
+      size_t dim = tree.dim();
+      coordinate_type bound = 0;
+      for(size_t a = tree[q].begin; a < q_end; ++a){
+	size_t c = comp[a];
+	if(best_source[c] == npos || !(tree.point_box_distance2(tree.point(a), r) > best_weight[c])){
+	  for(size_t b = tree[r].begin; b < r_end; ++b){
+	    size_t c_b = comp[b];
+	    if(c_b == c)
+	      continue;
+	    coordinate_type w = kernel::squared_euclidean<coordinate_type>(tree.point(a), tree.point(b), dim);
+	    if(better(w, a, b, c)){
+	      best_weight[c] = w;
+	      best_source[c] = a;
+	      best_target[c] = b;
+	    }
+	    // the edge leaves the component of b as well
+	    if(better(w, b, a, c_b)){
+	      best_weight[c_b] = w;
+	      best_source[c_b] = b;
+	      best_target[c_b] = a;
+	    }
+	  }
+	}
+	coordinate_type w = best_source[c] == npos ? std::numeric_limits<coordinate_type>::max() : best_weight[c];
+	bound = std::max(bound, w);
+      }
+      node_bound[q] = bound;
+      return;
+    }
+
+    if(tree.is_leaf(q)){
+      size_t near = tree[r].left, far = tree[r].right;
+      if(tree.box_distance2(q, far) < tree.box_distance2(q, near))
+	std::swap(near, far);
+      dual(q, near);
+      dual(q, far);
+      return;
+    }
+
+    size_t q_child[2] = {tree[q].left, tree[q].right};
+    for(size_t i = 0; i != 2; ++i){
+      if(tree.is_leaf(r)){
+	dual(q_child[i], r);
+      }else{
+	size_t near = tree[r].left, far = tree[r].right;
+	if(tree.box_distance2(q_child[i], far) < tree.box_distance2(q_child[i], near))
+	  std::swap(near, far);
+	dual(q_child[i], near);
+	dual(q_child[i], far);
+      }
+    }
+    node_bound[q] = std::max(node_bound[q_child[0]], node_bound[q_child[1]]);
+  }
+
+
+  template <typename random_access_data, typename graph, typename property_map>
+  void euclidean_minimum_spanning_tree(const random_access_data data, const random_access_data data_end, graph& mst, property_map weight){
+    // MST of data with Euclidean distances, data points need begin()
+    // and end(). Same interface as minimum_spanning_tree.
+    CLUSTEROL_PROFILE_SCOPE("euclidean_minimum_spanning_tree");
+    using namespace boost;
+    typedef typename graph_traits<graph>::edge_descriptor edge;
+    typedef typename dual_tree_boruvka<double>::edge_type edge_type;
+
+    kd_tree<double> tree(data, data_end);
+    mst = graph(tree.size());
+    if(tree.size() < 2)
+      return;
+
+    std::vector<edge_type> tree_edge;
+    tree_edge.reserve(tree.size() - 1);
+    dual_tree_boruvka<double>(tree).run(tree_edge);
+
+    for(size_t i = 0; i != tree_edge.size(); ++i){
+      edge e = add_edge(tree.index(tree_edge[i].source), tree.index(tree_edge[i].target), mst).first;
+      weight[e] = std::sqrt(tree_edge[i].weight);
+    }
+  }
+
+
+  template <typename height_type, typename random_access_iterator>
+  void single_link_kdtree(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end,
+			  const stop_criterion& stop = stop_criterion()){
+    // single link with Euclidean distances via dual-tree Boruvka,
+    // for many low-dimensional data points
+    using namespace boost;
+    typedef adjacency_list<vecS, vecS, undirectedS, no_property, property<edge_weight_t, height_type> > mst_type;
+    mst_type mst;
+
+    euclidean_minimum_spanning_tree(data, data_end, mst, get(edge_weight, mst));
+    dendrogram_from_mst(dend, mst, stop);
+  }
+
+}
+
+#endif /* _CLUSTEROL_BORUVKA_H_ */
@@ -2,7 +2,15 @@
 #define _CLUSTEROL_CLUSTER_H_
 
 #include "matrix_based.hpp"
+#include "nn_chain.hpp"
+#include "generic_linkage.hpp"
 #include "minimum_spanning_tree.hpp"
+#include "boruvka.hpp"
+#include "geometric.hpp"
+#include "precomputed.hpp"
+#include "file_matrix.hpp"
+#include "dissimilarity.hpp"
+#include "profile.hpp"
 #include <string>
 #include <stdexcept>
 
@@ -11,56 +19,328 @@
 
 namespace clusterol{
 
-  template <typename height_type, typename random_access_iterator, typename dissimilarity>
-  dendrogram<height_type> cluster(random_access_iterator data, random_access_iterator data_end, const std::string& method, dissimilarity d){
-    // Parse method and cluster data with dissimilarity.
+  struct cluster_options{
+    // settings for cluster() besides method and dissimilarity
+    cluster_options(): memory_limit(0) {}
 
-    const std::string available_methods[] = {"matrix-single-link",  "complete-link",
-					     "ward",
-					     "group-average", "weighted-group-average",
-					     "centroid", "median",
-					     // "energy", "Linf",
-					     "single-link"
-    };
-    const std::string* available_methods_end = available_methods + 8;
+    // Bytes for the dissimilarities, 0: no limit. If the n(n-1)/2
+    // dissimilarities don't fit, methods that need them all work on
+    // a file_matrix in scratch_dir ("": $TMPDIR or /tmp) with this
+    // much memory for its rows.
+    size_t memory_limit;
+    std::string scratch_dir;
+    // Stop early, dend then holds the merges up to there and
+    // dend.labels() the flat clusters, see stop_criterion.
+    stop_criterion stop;
+  };
 
-    if(std::find(available_methods, available_methods_end, method.c_str()) == available_methods_end){
-      throw std::runtime_error("Requested clustering method not available.");
+
+  namespace{
+    template <typename height_type, typename random_access_iterator, typename dissimilarity>
+    void single_link_kdtree_if_possible(dendrogram<height_type>&, random_access_iterator, random_access_iterator, dissimilarity, const stop_criterion&){
+      // the kd-tree bounds are Euclidean
+      throw std::runtime_error("single-link-kdtree needs the Euclidean distance.");
+    }
+
+    template <typename height_type, typename random_access_iterator>
+    void single_link_kdtree_if_possible(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end,
+					dissimilarity_be<euclidean_distance>, const stop_criterion& stop){
+      single_link_kdtree(dend, data, data_end, stop);
+    }
+
+    template <typename height_type, typename random_access_iterator>
+    void single_link_kdtree_if_possible(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end,
+					dissimilarity_be< double_accumulation<euclidean_distance> >, const stop_criterion& stop){
+      // the kd-tree works in double anyway
+      single_link_kdtree(dend, data, data_end, stop);
+    }
+
+    template <typename height_type, typename random_access_iterator, typename dissimilarity>
+    void geometric_cluster_if_possible(dendrogram<height_type>&, random_access_iterator, random_access_iterator, dissimilarity,
+				       geometric_method, const stop_criterion&){
+      // centroids only exist for Euclidean data points
+      throw std::runtime_error("geometric methods need data points and the Euclidean distance.");
+    }
+
+    template <typename height_type, typename random_access_iterator>
+    void geometric_cluster_if_possible(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end,
+				       dissimilarity_be<euclidean_distance>, geometric_method method, const stop_criterion& stop){
+      geometric_cluster(dend, data, data_end, method, stop);
+    }
+
+    template <typename height_type, typename random_access_iterator>
+    void geometric_cluster_if_possible(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end,
+				       dissimilarity_be< double_accumulation<euclidean_distance> >, geometric_method method,
+				       const stop_criterion& stop){
+      // centroids are kept in double anyway
+      geometric_cluster(dend, data, data_end, method, stop);
     }
 
+    template <typename height_type, typename value_type>
+    void single_link_kdtree_if_possible(dendrogram<height_type>&, index_iterator, index_iterator, precomputed_dissimilarity<value_type>,
+					const stop_criterion&){
+      // there are no coordinates to build a kd-tree from
+      throw std::runtime_error("single-link-kdtree needs data points, not precomputed dissimilarities.");
+    }
+
+
+    template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+    void out_of_core_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d, lance_williams lw,
+			     const cluster_options& options){
+      // matrix_cluster on a dissimilarity matrix in a scratch file
+      typedef file_matrix<height_type> storage_t;
+      dissimilarity_matrix<height_type, typename storage_t::index_type, storage_t> dis_mat(data, data_end, d, options.memory_limit, options.scratch_dir);
+      matrix_cluster(dend, dis_mat, lw, options.stop);
+    }
+
+
+    // engines of the Lance-Williams methods
+    struct nn_chain_engine{};
+    struct generic_engine{};
+    struct matrix_engine{};
+
+    template <typename height_type>
+    bool out_of_core(const dendrogram<height_type>& dend, const cluster_options& options){
+      // do the n(n-1)/2 dissimilarities exceed the memory limit?
+      size_t n = dend.n_data_point;
+      size_t n_pair = n > 1 ? n * (n - 1) / 2 : 0;
+      return options.memory_limit > 0 && n_pair * sizeof(height_type) > options.memory_limit;
+    }
+
+    template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+    void lance_williams_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d,
+				lance_williams lw, const cluster_options& options, nn_chain_engine){
+      if(out_of_core(dend, options))
+	out_of_core_cluster(dend, data, data_end, d, lw, options);
+      else
+	nn_chain_cluster<height_type>(dend, data, data_end, d, lw, options.stop);
+    }
+
+    template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+    void lance_williams_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d,
+				lance_williams lw, const cluster_options& options, generic_engine){
+      if(out_of_core(dend, options))
+	out_of_core_cluster(dend, data, data_end, d, lw, options);
+      else
+	generic_cluster<height_type>(dend, data, data_end, d, lw, options.stop);
+    }
 
-    // lance_williams_generic lw(0.5, 0.5, 0, -0.5); // single link 
-    // lance_williams lw(0.5, 0.5, 0, 0.5);	// complete link
-    // lance_williams lw(0.5, 0.5, 0, 0);	// weighted group average
-    // lance_williams lw(0.5, 0.5, -0.25, 0);// Median (weighted centroid
-
-    size_t n_data_point = std::distance(data, data_end);
-    dendrogram<height_type> dend(n_data_point);
-    if(method == "matrix-single-link"){
-      lance_williams_generic lw(0.5, 0.5, 0, -0.5);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "complete-link"){
-      lance_williams_generic lw(0.5, 0.5, 0, 0.5);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "ward"){
-      lance_williams_ward<height_type> lw(dend);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "group-average"){
-      lance_williams_group_average<height_type> lw(dend);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "weighted-group-average"){
-      lance_williams_generic lw(0.5, 0.5, 0, 0);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "centroid"){
-      lance_williams_centroid<height_type> lw(dend);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "median"){
-      lance_williams_generic lw(0.5, 0.5, -0.25, 0);
-      matrix_cluster<height_type>(dend, data, data_end, d, lw);
-    }else if(method == "single-link"){
-      // single_link_mst is default single-link because it's faster
-      single_link_mst(dend, data, data_end, d);
+    template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+    void lance_williams_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d,
+				lance_williams lw, const cluster_options& options, matrix_engine){
+      if(out_of_core(dend, options))
+	out_of_core_cluster(dend, data, data_end, d, lw, options);
+      else
+	matrix_cluster<height_type>(dend, data, data_end, d, lw, options.stop);
     }
+  }
+
+
+  // Method tags: cluster(dend, data, data_end, methods::ward(), d)
+  // instantiates only the engine and Lance-Williams formula of ward,
+  // fixed coefficients are compile-time constants. dend must have
+  // been constructed with the number of data points.
+  namespace methods{
+    struct single_link{};
+    struct single_link_kdtree{};
+    struct complete_link{};
+    struct ward{};
+    struct group_average{};
+    struct weighted_group_average{};
+    struct centroid{};
+    struct median{};
+    struct matrix_single_link{};
+    struct matrix_complete_link{};
+    struct matrix_ward{};
+    struct matrix_group_average{};
+    struct matrix_weighted_group_average{};
+    struct matrix_centroid{};
+    struct matrix_median{};
+    struct geometric_ward{};
+    struct geometric_centroid{};
+    struct geometric_median{};
+  }
+
+
+  // reducible methods use the nearest-neighbor chain because it's faster
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::complete_link, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_complete_link(), options, nn_chain_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::ward, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_ward<height_type>(dend), options, nn_chain_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::group_average, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_group_average<height_type>(dend), options, nn_chain_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::weighted_group_average,
+	       dissimilarity d, const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_weighted_group_average(), options, nn_chain_engine());
+  }
+
+
+  // not reducible, cached nearest neighbors instead of the chain
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::centroid, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_centroid<height_type>(dend), options, generic_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::median, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_median(), options, generic_engine());
+  }
+
+
+  // the dissimilarity matrix variants
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_single_link, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_single_link(), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_complete_link,
+	       dissimilarity d, const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_complete_link(), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_ward, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_ward<height_type>(dend), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_group_average,
+	       dissimilarity d, const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_group_average<height_type>(dend), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_weighted_group_average,
+	       dissimilarity d, const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_weighted_group_average(), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_centroid, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_centroid<height_type>(dend), options, matrix_engine());
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::matrix_median, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    lance_williams_cluster(dend, data, data_end, d, lance_williams_median(), options, matrix_engine());
+  }
+
+
+  // without Lance-Williams
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::single_link, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    // single_link_mst is default single-link because it's faster
+    single_link_mst(dend, data, data_end, d, options.stop);
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::single_link_kdtree, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    // sub-quadratic for low dimensions, Euclidean only
+    single_link_kdtree_if_possible(dend, data, data_end, d, options.stop);
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::geometric_ward, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    // O(n d) memory, heights are those of ward on squared Euclidean
+    // distances, see geometric.hpp
+    geometric_cluster_if_possible(dend, data, data_end, d, geometric_ward, options.stop);
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::geometric_centroid, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    geometric_cluster_if_possible(dend, data, data_end, d, geometric_centroid, options.stop);
+  }
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  void cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, methods::geometric_median, dissimilarity d,
+	       const cluster_options& options = cluster_options()){
+    geometric_cluster_if_possible(dend, data, data_end, d, geometric_median, options.stop);
+  }
+
+
+  // the methods cluster() below parses
+  const char* const method_names[] = {"single-link", "single-link-kdtree", "complete-link", "ward", "group-average",
+				      "weighted-group-average", "centroid", "median", "matrix-single-link",
+				      "matrix-complete-link", "matrix-ward", "matrix-group-average",
+				      "matrix-weighted-group-average", "matrix-centroid", "matrix-median", "geometric-ward",
+				      "geometric-centroid", "geometric-median"};
+
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity>
+  dendrogram<height_type> cluster(random_access_iterator data, random_access_iterator data_end, const std::string& method, dissimilarity d,
+				  const cluster_options& options = cluster_options()){
+    // Parse method and cluster data with dissimilarity, a thin wrapper
+    // around the method tags. This instantiates all engines.
+    CLUSTEROL_PROFILE_SCOPE("cluster");
+    dendrogram<height_type> dend(std::distance(data, data_end));
+
+    if(method == "single-link")
+      cluster(dend, data, data_end, methods::single_link(), d, options);
+    else if(method == "single-link-kdtree")
+      cluster(dend, data, data_end, methods::single_link_kdtree(), d, options);
+    else if(method == "complete-link")
+      cluster(dend, data, data_end, methods::complete_link(), d, options);
+    else if(method == "ward")
+      cluster(dend, data, data_end, methods::ward(), d, options);
+    else if(method == "group-average")
+      cluster(dend, data, data_end, methods::group_average(), d, options);
+    else if(method == "weighted-group-average")
+      cluster(dend, data, data_end, methods::weighted_group_average(), d, options);
+    else if(method == "centroid")
+      cluster(dend, data, data_end, methods::centroid(), d, options);
+    else if(method == "median")
+      cluster(dend, data, data_end, methods::median(), d, options);
+    else if(method == "matrix-single-link")
+      cluster(dend, data, data_end, methods::matrix_single_link(), d, options);
+    else if(method == "matrix-complete-link")
+      cluster(dend, data, data_end, methods::matrix_complete_link(), d, options);
+    else if(method == "matrix-ward")
+      cluster(dend, data, data_end, methods::matrix_ward(), d, options);
+    else if(method == "matrix-group-average")
+      cluster(dend, data, data_end, methods::matrix_group_average(), d, options);
+    else if(method == "matrix-weighted-group-average")
+      cluster(dend, data, data_end, methods::matrix_weighted_group_average(), d, options);
+    else if(method == "matrix-centroid")
+      cluster(dend, data, data_end, methods::matrix_centroid(), d, options);
+    else if(method == "matrix-median")
+      cluster(dend, data, data_end, methods::matrix_median(), d, options);
+    else if(method == "geometric-ward")
+      cluster(dend, data, data_end, methods::geometric_ward(), d, options);
+    else if(method == "geometric-centroid")
+      cluster(dend, data, data_end, methods::geometric_centroid(), d, options);
+    else if(method == "geometric-median")
+      cluster(dend, data, data_end, methods::geometric_median(), d, options);
+    else
+      // "energy", "Linf" are not available (yet)
+      throw std::runtime_error("Requested clustering method not available.");
 
     return dend;
   }
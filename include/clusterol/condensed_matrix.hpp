@@ -0,0 +1,277 @@
+#ifndef _CLUSTEROL_CONDENSED_MATRIX_H_
+#define _CLUSTEROL_CONDENSED_MATRIX_H_
+
+#include "pdist.hpp"
+#include "profile.hpp"
+#include <vector>
+#include <limits>
+#include <iterator>
+#include <stdexcept>
+#include <stdint.h>
+
+
+// A dissimilarity matrix stored as one flat condensed triangular array.
+// The layout is the upper triangle, row by row, as in R's dist and
+// scipy's pdist: (0,1), (0,2), ..., (0,n-1), (1,2), ..., (n-2,n-1).
+// Rows are addressed by index 0..n-1, clusters by an external id
+// (vertex_descriptor in the dendrogram) like in dissimilarity_matrix.
+// index_t must hold the 2n-1 cluster ids. active_rows keeps track of
+// rows and ids, also for other matrix storages.
+
+namespace clusterol{
+
+  template <typename matrix_t>
+  struct row_id_iterator{
+    // forward iterator over the active rows of a condensed_matrix,
+    // returns the cluster id of a row when dereferenced
+
+    typedef size_t value_type;
+    typedef const size_t* pointer;
+    typedef size_t reference;
+    typedef ptrdiff_t difference_type;
+    typedef std::forward_iterator_tag iterator_category;
+
+    row_id_iterator(const matrix_t* matrix_ = 0, size_t r_ = matrix_t::npos): matrix(matrix_), r(r_) {}
+
+    bool operator==(const row_id_iterator<matrix_t>& other) const{
+      return r == other.r;
+    }
+
+    bool operator!=(const row_id_iterator<matrix_t>& other) const{
+      return r != other.r;
+    }
+
+    reference operator*() const{
+      return matrix->id(r);
+    }
+
+    // prefix: reference, postfix: copy
+    row_id_iterator<matrix_t>& operator++(){
+      r = matrix->next_row(r);
+      return *this;
+    }
+
+    row_id_iterator<matrix_t> operator++(int postfix){
+      row_id_iterator<matrix_t> result = *this;
+      r = matrix->next_row(r);
+      return result;
+    }
+
+  private:
+    const matrix_t* matrix;
+    size_t r;
+  };
+
+
+  template <typename index_t>
+  class active_rows{
+    // Rows 0..n-1 of a matrix and the cluster ids they hold. Active
+    // rows form a sorted linked list, npos terminates. Erasing a row
+    // only unlinks it.
+  public:
+    static const index_t npos = index_t(-1);
+
+    active_rows(size_t n_)
+      : n(n_),
+	n_valid(n_),
+	next(n_ + 1),
+	prev(n_ + 1),
+	id_to_row(n_ > 0 ? 2 * n_ - 1 : 0, npos),
+	row_to_id(n_)
+    {
+      if(n > 0 && 2 * n - 1 >= size_t(npos))
+	throw std::length_error("active_rows: too many data points for index type");
+
+      // all rows are active, ids are data point indices
+      for(size_t i = 0; i != n; ++i){
+	id_to_row[i] = i;
+	row_to_id[i] = i;
+	next[i] = i + 1 < n ? i + 1 : npos;
+	prev[i] = i > 0 ? i - 1 : n;
+      }
+      next[n] = n > 0 ? 0 : npos;
+    }
+
+    index_t first_row() const{
+      return next[n];
+    }
+
+    index_t next_row(size_t r) const{
+      return next[r];
+    }
+
+    index_t row(size_t id) const{
+      return id_to_row[id];
+    }
+
+    index_t id(size_t r) const{
+      return row_to_id[r];
+    }
+
+    void erase(size_t id){
+      // remove the row of id from the active list
+      index_t r = id_to_row[id];
+      next[prev[r]] = next[r];
+      if(next[r] != npos)
+	prev[next[r]] = prev[r];
+      id_to_row[id] = npos;
+      row_to_id[r] = npos;
+      --n_valid;
+    }
+
+    void move(size_t old_id, size_t new_id){
+      // mv from old_id to new_id, the row stays the same
+      index_t r = id_to_row[old_id];
+      id_to_row[old_id] = npos;
+      if(new_id >= id_to_row.size())
+	id_to_row.resize(new_id + 1, npos);
+      id_to_row[new_id] = r;
+      row_to_id[r] = new_id;
+    }
+
+    bool is_valid(size_t id) const{
+      return id < id_to_row.size() && id_to_row[id] != npos;
+    }
+
+    size_t valid() const{
+      return n_valid;
+    }
+
+    size_t size() const{
+      // number of rows, including erased ones
+      return n;
+    }
+
+  private:
+    size_t n, n_valid;
+    std::vector<index_t> next, prev;	// active rows, sentinel at n
+    std::vector<index_t> id_to_row, row_to_id;
+  };
+
+
+  template <typename index_t>
+  const index_t active_rows<index_t>::npos;
+
+
+  template <typename dis_val = double, typename index_t = uint32_t>
+  class condensed_matrix{
+  public:
+    typedef dis_val value_type;
+    typedef index_t index_type;
+    typedef row_id_iterator< condensed_matrix<dis_val, index_t> > id_iterator;
+    static const index_t npos = index_t(-1);
+    // rows can be read from several threads at once
+    static const bool concurrent_reads = true;
+
+    template <typename random_access_iterator, typename dissimilarity_t>
+    condensed_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity);
+
+
+    // row access, a != b
+    dis_val& at(size_t a, size_t b){
+      return a < b ? matrix[offset(a, b)] : matrix[offset(b, a)];
+    }
+
+    dis_val at(size_t a, size_t b) const{
+      return a < b ? matrix[offset(a, b)] : matrix[offset(b, a)];
+    }
+
+    void hold_row(size_t) const{
+      // all rows are in memory, see file_matrix
+    }
+
+    index_t first_row() const{
+      return rows.first_row();
+    }
+
+    index_t next_row(size_t r) const{
+      return rows.next_row(r);
+    }
+
+    index_t row(size_t id) const{
+      return rows.row(id);
+    }
+
+    index_t id(size_t r) const{
+      return rows.id(r);
+    }
+
+
+    // id access, like dissimilarity_matrix
+    dis_val operator()(size_t id_a, size_t id_b) const{
+      if(id_a == id_b)
+	return 0;
+      return at(rows.row(id_a), rows.row(id_b));
+    }
+
+    void update(size_t id_a, size_t id_b, dis_val value){
+      if(id_a != id_b)
+	at(rows.row(id_a), rows.row(id_b)) = value;
+    }
+
+    void erase(size_t id){
+      rows.erase(id);
+    }
+
+    void move(size_t old_id, size_t new_id){
+      rows.move(old_id, new_id);
+    }
+
+    bool is_valid(size_t id) const{
+      return rows.is_valid(id);
+    }
+
+    size_t valid() const{
+      return rows.valid();
+    }
+
+    size_t size() const{
+      // number of rows, including erased ones
+      return rows.size();
+    }
+
+    id_iterator id_begin() const{
+      // iterate over ids
+      return id_iterator(this, first_row());
+    }
+
+    id_iterator id_end() const{
+      return id_iterator(this, npos);
+    }
+
+  private:
+    size_t offset(size_t a, size_t b) const{
+      // a < b
+      return a * (2 * n - a - 3) / 2 + b - 1;
+    }
+
+    size_t n;
+    active_rows<index_t> rows;
+    std::vector<dis_val> matrix;	// condensed upper triangle
+  };
+
+
+  template <typename dis_val, typename index_t>
+  const index_t condensed_matrix<dis_val, index_t>::npos;
+
+  template <typename dis_val, typename index_t>
+  const bool condensed_matrix<dis_val, index_t>::concurrent_reads;
+
+
+  template <typename dis_val, typename index_t>
+  template <typename random_access_iterator, typename dissimilarity_t>
+  condensed_matrix<dis_val, index_t>::condensed_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity)
+    : n(std::distance(data, data_end)),
+      rows(n),
+      matrix(n > 1 ? n * (n - 1) / 2 : 0)
+  {
+    // calculate matrix from data with dissimilarity
+    CLUSTEROL_PROFILE_SCOPE("condensed_matrix");
+    CLUSTEROL_PROFILE_COUNT("distance_calls", matrix.size());
+    CLUSTEROL_PROFILE_COUNT("allocated_bytes.condensed_matrix", matrix.size() * sizeof(dis_val));
+    pdist(data, data_end, dissimilarity, matrix.begin());
+  }
+
+}
+
+#endif /* _CLUSTEROL_CONDENSED_MATRIX_H_ */
@@ -0,0 +1,39 @@
+#ifndef _CLUSTEROL_CUT_TREE_H_
+#define _CLUSTEROL_CUT_TREE_H_
+
+#include "dendrogram.hpp"
+#include <vector>
+
+
+// Flat clusters from a dendrogram in O(n), like R's cutree: every data
+// point gets a label 0, 1, ... numbered in the order of the first data
+// point of each cluster. Only the first merges of dend.linkage count,
+// the vertex of a cluster is the largest one above its data points
+// (see dendrogram::labels), no tree is traversed.
+
+namespace clusterol{
+
+  template <typename height_type>
+  std::vector<size_t> cut_tree(const dendrogram<height_type>& dend, size_t k){
+    // k clusters, or as few as dend has if it was stopped early
+    size_t n_merge = k < dend.n_data_point ? dend.n_data_point - k : 0;
+    if(n_merge > dend.linkage.size())
+      n_merge = dend.linkage.size();
+    return dend.labels(n_merge);
+  }
+
+
+  template <typename height_type>
+  std::vector<size_t> cut_height(const dendrogram<height_type>& dend, height_type h){
+    // The clusters below height h: all merges before the first one
+    // higher than h. Methods with inversions (centroid, median) may
+    // have lower merges after that one, they are cut as well.
+    size_t n_merge = 0;
+    while(n_merge != dend.linkage.size() && !(dend.height[dend.n_data_point + n_merge] > h))
+      ++n_merge;
+    return dend.labels(n_merge);
+  }
+
+}
+
+#endif /* _CLUSTEROL_CUT_TREE_H_ */
@@ -4,37 +4,124 @@
 #include "join_report.hpp"
 #include <boost/graph/adjacency_list.hpp>
 #include <vector>
+#include <utility>
+#include <limits>
 
 
 // Dendrogram struct
 
 namespace clusterol{
 
+  struct stop_criterion{
+    // Stop clustering early, when k clusters are left or before the
+    // first merge higher than max_height. The default builds the whole
+    // dendrogram.
+    stop_criterion(size_t k_ = 1, double max_height_ = std::numeric_limits<double>::infinity())
+      : k(k_), max_height(max_height_)
+    {}
+
+    bool operator()(size_t n_cluster, double next_height) const{
+      // stop before merging at next_height with n_cluster clusters?
+      return n_cluster <= k || next_height > max_height;
+    }
+
+    size_t k;
+    double max_height;
+  };
+
+
   template <typename height_type = double>
   struct dendrogram{
     typedef boost::adjacency_list<> tree_type;
     typedef boost::graph_traits<tree_type>::vertex_descriptor vertex_descriptor;
     typedef join_report_entry<height_type, vertex_descriptor> join_report_entry_type;
 
+    // one merge, linkage[i] creates vertex n_data_point + i
+    struct linkage_entry{
+      vertex_descriptor left, right;
+      height_type height;
+      size_t size;
+    };
+
     // convenient constructor
-    dendrogram(size_t n_data_point)
-      : tree(tree_type(n_data_point)),
+    dendrogram(size_t n_data_point_)
+      : n_data_point(n_data_point_),
 	root(0),
-	size(2 * n_data_point - 1),
-	height(2 * n_data_point - 1)
+	size(n_data_point_ > 0 ? 2 * n_data_point_ - 1 : 0),
+	height(n_data_point_ > 0 ? 2 * n_data_point_ - 1 : 0)
     {
       // 1 data point in first n clusters
       for(size_t i = 0; i != n_data_point; ++i)
 	size[i] = 1;
+      linkage.reserve(n_data_point > 0 ? n_data_point - 1 : 0);
     }
 
     // allow default construction
-    dendrogram() {}
-    
+    dendrogram(): n_data_point(0), root(0) {}
+
+
+    vertex_descriptor join(vertex_descriptor a, vertex_descriptor b, height_type h){
+      // merge clusters a and b at height h, return the new cluster
+      vertex_descriptor parent = n_data_point + linkage.size();
+      height[parent] = h;
+      size[parent] = size[a] + size[b];
+      linkage_entry entry = {a, b, h, size[parent]};
+      linkage.push_back(entry);
+      root = parent;
+      return parent;
+    }
+
+
+    size_t n_cluster() const{
+      // clusters left, more than 1 if clustering stopped early
+      return n_data_point - linkage.size();
+    }
+
+
+    std::vector<size_t> labels(size_t n_merge) const{
+      // The cluster of every data point after the first n_merge
+      // merges, numbered 0, 1, ... in the order of their first data
+      // points. Parents have larger vertices than their children, so
+      // one backward pass finds the top vertex of every vertex.
+      static const size_t npos = size_t(-1);
+      size_t n_vertex = n_data_point + n_merge;
+      std::vector<size_t> top(n_vertex, npos);
+      for(size_t i = 0; i != n_merge; ++i)
+	top[linkage[i].left] = top[linkage[i].right] = n_data_point + i;
+      for(size_t v = n_vertex; v-- > 0;)
+	top[v] = top[v] == npos ? v : top[top[v]];
+
+      std::vector<size_t> label_of_top(n_vertex, npos);
+      std::vector<size_t> label(n_data_point);
+      size_t n_label = 0;
+      for(size_t i = 0; i != n_data_point; ++i){
+	size_t& l = label_of_top[top[i]];
+	if(l == npos)
+	  l = n_label++;
+	label[i] = l;
+      }
+      return label;
+    }
+
+
+    tree_type tree() const{
+      // the dendrogram as a graph with edges from parent to children,
+      // built on every call
+      std::vector< std::pair<size_t, size_t> > tree_edge;
+      tree_edge.reserve(2 * linkage.size());
+      for(size_t i = 0; i != linkage.size(); ++i){
+	tree_edge.push_back(std::make_pair(n_data_point + i, size_t(linkage[i].left)));
+	tree_edge.push_back(std::make_pair(n_data_point + i, size_t(linkage[i].right)));
+      }
+      return tree_type(tree_edge.begin(), tree_edge.end(), n_data_point + linkage.size());
+    }
+
 
-    tree_type tree;
+    size_t n_data_point;
+    std::vector<linkage_entry> linkage;
     // mostly unnecessary, since last vertex in tree is (always?) root:
     vertex_descriptor root;	
+    // by vertex, also for clusters merged later (Lance-Williams needs them)
     std::vector<size_t> size;    // number of data points in a cluster
     std::vector<height_type> height;
   };
@@ -0,0 +1,264 @@
+#ifndef _CLUSTEROL_DENDROGRAM_OUTPUT_H_
+#define _CLUSTEROL_DENDROGRAM_OUTPUT_H_
+
+#include "dendrogram.hpp"
+#include <charconv>
+#include <ostream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <stdint.h>
+
+
+// Writers for dendrograms, streamed from the linkage without building
+// a tree or a join report. Numbers are formatted with std::to_chars
+// into a buffer that goes to the stream in large blocks.
+//   write_join_report     "left right height" per merge, ids as in R's
+//                         hclust$merge
+//   write_graphviz        the same graph as boost::write_graphviz of
+//                         dendrogram::tree() with height labels
+//   write_newick          one tree per cluster left, leaves 1..n,
+//                         branch lengths are differences of heights
+//   write_linkage_binary  compact binary linkage, read_linkage_binary
+//                         reads it back
+// The binary format is the text line
+// "clusterol-linkage n_data_point n_merge sizeof(height_type)\n"
+// followed by one record per merge: uint32 left, uint32 right (vertex
+// ids, data points 0..n-1, merge i creates n + i) and the height,
+// packed and in native byte order.
+
+namespace clusterol{
+
+  class output_buffer{
+    // text and bytes collected for an ostream, flushed when full and
+    // by the destructor
+  public:
+    output_buffer(std::ostream& out_): out(out_), end(0) {}
+    ~output_buffer(){
+      flush();
+    }
+
+    void put(char c){
+      reserve(1);
+      buffer[end++] = c;
+    }
+
+    void put(const char* s){
+      for(; *s; ++s)
+	put(*s);
+    }
+
+    void put_bytes(const void* p, size_t n){
+      reserve(n);
+      std::memcpy(buffer + end, p, n);
+      end += n;
+    }
+
+    template <typename T>
+    void put_integer(T x){
+      reserve(max_number);
+      end = std::to_chars(buffer + end, buffer + capacity, x).ptr - buffer;
+    }
+
+    template <typename T>
+    void put_real(T x, int digits){
+      // as std::setprecision(digits) or %.{digits}g
+      reserve(max_number);
+      end = std::to_chars(buffer + end, buffer + capacity, x, std::chars_format::general, digits).ptr - buffer;
+    }
+
+    void flush(){
+      out.write(buffer, end);
+      end = 0;
+    }
+
+  private:
+    output_buffer(const output_buffer&);
+    output_buffer& operator=(const output_buffer&);
+
+    void reserve(size_t n){
+      if(end + n > capacity)
+	flush();
+    }
+
+    static const size_t capacity = 1 << 16;
+    static const size_t max_number = 64; // digits of any number written
+    std::ostream& out;
+    size_t end;
+    char buffer[capacity];
+  };
+
+
+  template <typename input_iterator>
+  void write_join_report(std::ostream& out, input_iterator first, input_iterator last, size_t n_data_point, int digits){
+    // one line "left right height" per join_report_entry, ids as
+    // vertex_descriptor_to_R, heights with digits significant digits
+    output_buffer buffer(out);
+    for(; first != last; ++first){
+      buffer.put_integer(vertex_descriptor_to_R(first->pair.first, n_data_point));
+      buffer.put(' ');
+      buffer.put_integer(vertex_descriptor_to_R(first->pair.second, n_data_point));
+      buffer.put(' ');
+      buffer.put_real(first->height, digits);
+      buffer.put('\n');
+    }
+  }
+
+
+  template <typename height_type>
+  void write_join_report(std::ostream& out, const dendrogram<height_type>& dend, int digits){
+    // the join report of dend in merge order
+    write_join_report(out, join_report_begin(dend), join_report_end(dend), dend.n_data_point, digits);
+  }
+
+
+  template <typename height_type>
+  void write_graphviz(std::ostream& out, const dendrogram<height_type>& dend){
+    // directed graph with edges from parents to children, vertices are
+    // labeled with their heights (data points 0)
+    output_buffer buffer(out);
+    size_t n_vertex = dend.n_data_point + dend.linkage.size();
+    buffer.put("digraph G {\n");
+    for(size_t v = 0; v != n_vertex; ++v){
+      // all digits, quoted unless a valid DOT id (no exponent, no
+      // "-inf"), as boost's label_writer does
+      height_type h = v < dend.n_data_point ? height_type(0) : dend.linkage[v - dend.n_data_point].height;
+      char label[64];
+      size_t length = std::to_chars(label, label + sizeof(label), h, std::chars_format::general,
+				    std::numeric_limits<height_type>::max_digits10).ptr - label;
+      bool quote = std::memchr(label, 'e', length) || (label[0] == '-' && std::memchr(label, 'n', length));
+      buffer.put_integer(v);
+      buffer.put("[label=");
+      if(quote)
+	buffer.put('"');
+      buffer.put_bytes(label, length);
+      if(quote)
+	buffer.put('"');
+      buffer.put("];\n");
+    }
+    for(size_t i = 0; i != dend.linkage.size(); ++i){
+      size_t child[2] = {dend.linkage[i].left, dend.linkage[i].right};
+      for(size_t k = 0; k != 2; ++k){
+	buffer.put_integer(dend.n_data_point + i);
+	buffer.put("->");
+	buffer.put_integer(child[k]);
+	buffer.put(" ;\n");
+      }
+    }
+    buffer.put("}\n");
+  }
+
+
+  template <typename height_type>
+  void write_newick(std::ostream& out, const dendrogram<height_type>& dend, int digits){
+    // Newick trees like ((1:0.5,2:0.5):0.25,3:0.75); one per cluster
+    // left, in the order of their vertices. Depth-first with an
+    // explicit stack, a chain of n merges is fine.
+    static const size_t npos = size_t(-1);
+    size_t n = dend.n_data_point, n_vertex = n + dend.linkage.size();
+    std::vector<size_t> parent(n_vertex, npos);
+    for(size_t i = 0; i != dend.linkage.size(); ++i)
+      parent[dend.linkage[i].left] = parent[dend.linkage[i].right] = n + i;
+
+    struct visit{
+      size_t vertex;
+      int state;		// 0: open, 1: between the children, 2: close
+    };
+    std::vector<visit> stack;
+    output_buffer buffer(out);
+    for(size_t root = 0; root != n_vertex; ++root){
+      if(parent[root] != npos)
+	continue;
+
+      stack.push_back((visit) {root, 0});
+      while(!stack.empty()){
+	visit& top = stack.back();
+	size_t v = top.vertex;
+	if(v >= n && top.state == 0){
+	  buffer.put('(');
+	  top.state = 1;
+	  stack.push_back((visit) {dend.linkage[v - n].left, 0});
+	  continue;
+	}
+	if(v >= n && top.state == 1){
+	  buffer.put(',');
+	  top.state = 2;
+	  stack.push_back((visit) {dend.linkage[v - n].right, 0});
+	  continue;
+	}
+
+	if(v >= n)
+	  buffer.put(')');
+	else
+	  buffer.put_integer(v + 1);
+	if(v != root){
+	  height_type h = v < n ? height_type(0) : dend.linkage[v - n].height;
+	  buffer.put(':');
+	  buffer.put_real(dend.linkage[parent[v] - n].height - h, digits);
+	}
+	stack.pop_back();
+      }
+      buffer.put(";\n");
+    }
+  }
+
+
+  template <typename height_type>
+  void write_linkage_binary(std::ostream& out, const dendrogram<height_type>& dend){
+    // the binary linkage format above, vertex ids need 32 bits
+    size_t n_vertex = dend.n_data_point + dend.linkage.size();
+    if(n_vertex > uint32_t(-1))
+      throw(std::runtime_error("write_linkage_binary: too many data points for 32 bit ids"));
+
+    out << "clusterol-linkage " << dend.n_data_point << " " << dend.linkage.size() << " " << sizeof(height_type) << "\n";
+    output_buffer buffer(out);
+    for(size_t i = 0; i != dend.linkage.size(); ++i){
+      uint32_t pair[2] = {uint32_t(dend.linkage[i].left), uint32_t(dend.linkage[i].right)};
+      buffer.put_bytes(pair, sizeof(pair));
+      buffer.put_bytes(&dend.linkage[i].height, sizeof(height_type));
+    }
+  }
+
+
+  template <typename height_type>
+  dendrogram<height_type> read_linkage_binary(std::istream& in){
+    // a dendrogram from write_linkage_binary, heights of another size
+    // are an error
+    std::string header;
+    std::getline(in, header);
+    std::istringstream fields(header);
+    std::string magic;
+    size_t n = 0, n_merge = 0, height_size = 0;
+    fields >> magic >> n >> n_merge >> height_size;
+    if(!fields || magic != "clusterol-linkage" || n == 0 || n_merge >= n)
+      throw(std::runtime_error("read_linkage_binary: not a clusterol linkage"));
+    if(height_size != sizeof(height_type))
+      throw(std::runtime_error("read_linkage_binary: heights have a different size"));
+
+    dendrogram<height_type> dend(n);
+    std::vector<bool> merged(n + n_merge, false);
+    for(size_t i = 0; i != n_merge; ++i){
+      uint32_t pair[2];
+      height_type h;
+      in.read(reinterpret_cast<char*>(pair), sizeof(pair));
+      in.read(reinterpret_cast<char*>(&h), sizeof(h));
+      if(!in)
+	throw(std::runtime_error("read_linkage_binary: file is truncated"));
+      // children must exist and not have a parent yet
+      for(size_t k = 0; k != 2; ++k){
+	if(pair[k] >= n + i || merged[pair[k]])
+	  throw(std::runtime_error("read_linkage_binary: invalid merge"));
+	merged[pair[k]] = true;
+      }
+      dend.join(pair[0], pair[1], h);
+    }
+    return dend;
+  }
+
+}
+
+#endif /* _CLUSTEROL_DENDROGRAM_OUTPUT_H_ */
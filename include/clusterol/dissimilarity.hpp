@@ -1,8 +1,13 @@
 #ifndef _CLUSTEROL_DISSIMILARITY_H_
 #define _CLUSTEROL_DISSIMILARITY_H_
 
+#include "kernels.hpp"
 #include <cmath>
 #include <algorithm>
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <stdint.h>
 
 
 namespace clusterol{
@@ -15,7 +20,10 @@ namespace clusterol{
     dissimilarity_be(): dissimilarity(dissimilarity_t()) {}
 
     template<typename data_point>
-    double operator()(data_point& a, data_point& b){
+    auto operator()(const data_point& a, const data_point& b)
+      -> decltype(std::declval<dissimilarity_t&>()(a.begin(), a.end(), b.begin())){
+      // the type of dissimilarity_t's result, float for float data
+      // points without double_accumulation
       return dissimilarity(a.begin(), a.end(), b.begin());
     }
 
@@ -42,79 +50,104 @@ namespace clusterol{
   };
 
 
-  struct euclidean_distance{
-    template <typename input_iterator>
-    double operator()(input_iterator a_begin, input_iterator a_end, input_iterator b_begin){
-      double result = 0;
-      while(a_begin != a_end){
-	double diff = *a_begin++ - *b_begin++;
-	result += diff * diff;
-      }
+  template <typename kernel_t, typename float_accumulator = float>
+  struct kernel_distance{
+    // a metric from kernels.hpp, contiguous data uses the vectorized
+    // and fixed-dimension kernels. Double data points are summed up in
+    // double, float data points in float_accumulator.
+    typedef kernel_t kernel_type;
 
-      return sqrt(result);
+    template <typename random_access_iterator>
+    double operator()(random_access_iterator a_begin, random_access_iterator a_end, random_access_iterator b_begin){
+      return kernel_t::finish(kernel_t::scalar(a_begin, b_begin, std::distance(a_begin, a_end)));
+    }
+
+    double operator()(const double* a_begin, const double* a_end, const double* b_begin){
+      return kernel::by_dimension<kernel_t, double>(a_begin, b_begin, a_end - a_begin);
+    }
+
+    float_accumulator operator()(const float* a_begin, const float* a_end, const float* b_begin){
+      return kernel::by_dimension<kernel_t, float_accumulator>(a_begin, b_begin, a_end - a_begin);
+    }
+
+    double operator()(std::vector<double>::const_iterator a_begin, std::vector<double>::const_iterator a_end,
+		      std::vector<double>::const_iterator b_begin){
+      if(a_begin == a_end)
+	return 0;
+      return (*this)(&*a_begin, &*a_begin + (a_end - a_begin), &*b_begin);
+    }
+
+    float_accumulator operator()(std::vector<float>::const_iterator a_begin, std::vector<float>::const_iterator a_end,
+				 std::vector<float>::const_iterator b_begin){
+      if(a_begin == a_end)
+	return 0;
+      return (*this)(&*a_begin, &*a_begin + (a_end - a_begin), &*b_begin);
+    }
+  };
+
+
+  struct euclidean_distance: kernel_distance<kernel::euclidean_kernel> {};
+
+  struct squared_euclidean_distance: kernel_distance<kernel::squared_euclidean_kernel> {};
+
+  struct manhattan_distance: kernel_distance<kernel::manhattan_kernel> {};
+
+  struct chebyshev_distance: kernel_distance<kernel::chebyshev_kernel> {};
+
+  // 1 - cos(angle between a and b), see kernel::cosine_from_products
+  struct cosine_distance: kernel_distance<kernel::cosine_kernel> {};
+
+  // number of different values
+  struct hamming_distance: kernel_distance<kernel::hamming_kernel> {};
+
+
+  // distance_t for float data points, summed up in double and rounded
+  // to float only at the end, e.g. double_accumulation<euclidean_distance>
+  template <typename distance_t>
+  struct double_accumulation: kernel_distance<typename distance_t::kernel_type, double> {};
+
+
+  struct bit_hamming_distance{
+    // number of different bits, for data points packed into 64 bit
+    // words (see pack_bits)
+    template <typename random_access_iterator>
+    double operator()(random_access_iterator a_begin, random_access_iterator a_end, random_access_iterator b_begin){
+      return kernel::bit_hamming_kernel::scalar(a_begin, b_begin, std::distance(a_begin, a_end));
+    }
+
+    double operator()(const uint64_t* a_begin, const uint64_t* a_end, const uint64_t* b_begin){
+      return kernel::by_dimension<kernel::bit_hamming_kernel, uint64_t>(a_begin, b_begin, a_end - a_begin);
+    }
+
+    double operator()(std::vector<uint64_t>::const_iterator a_begin, std::vector<uint64_t>::const_iterator a_end,
+		      std::vector<uint64_t>::const_iterator b_begin){
+      if(a_begin == a_end)
+	return 0;
+      return (*this)(&*a_begin, &*a_begin + (a_end - a_begin), &*b_begin);
     }
   };
 
 
-  /********************************************************************************/
-  // more and advanced dissimilarities currently unsupported
-  
-  // struct squared_euclidean_distance{
-  //   template <typename input_iterator>
-  //   double operator()(input_iterator a_begin, input_iterator a_end, input_iterator b_begin){
-  //     double result = 0;
-  //     while(a_begin != a_end){
-  // 	double diff = *a_begin++ - *b_begin++;
-  // 	result += diff * diff;
-  //     }
-
-  //     return result;
-  //   }
-  // };
-
-
-  // struct hamming_distance{
-  //   template <typename input_iterator>
-  //   unsigned operator()(input_iterator a_begin, input_iterator a_end, input_iterator b_begin){
-  //     unsigned result = 0;
-  //     while(a_begin != a_end){
-  // 	if(*a_begin++ != *b_begin++)
-  // 	  result++;
-  //     }
-    
-  //     return result;
-  //   }
-  // };
-
-
-  // struct hamming_distance_bitset{
-  //   // hamming distance for std::bitset and boost::dynamic_bitset
-  //   template <typename bitset_t>
-  //   size_t operator()(const bitset_t& a,const bitset_t& b){
-  //     bitset_t tmp = a ^ b;
-  //     return tmp.count();
-  //   }
-  // };
-
-  // struct hamming_distance_bitset_opt{
-  //   // this should work, be fast and does not require non-const arguments
-  //   // (untested)
-  //   hamming_distance_bitset_opt(size_t size)
-  //     : helper_bs(size)
-  //   {}
-  
-  //   size_t operator()(const boost::dynamic_bitset<>& a, const boost::dynamic_bitset<>& b){
-  //     helper_bs.reset();
-  //     helper_bs ^= a;
-  //     helper_bs ^= b;
-
-  //     return helper_bs.count();
-  //   }
-
-  // private:
-  //   boost::dynamic_bitset<> helper_bs;
-  // }
-    
+  inline size_t packed_words(size_t dim){
+    // words per data point of dim bits
+    return (dim + 63) / 64;
+  }
+
+  template <typename input_iterator>
+  bool pack_bits(input_iterator begin, input_iterator end, uint64_t* bits){
+    // Pack binary values (0 or 1) into packed_words(dim) words, false
+    // if there is another value. Unused bits are 0.
+    size_t j = 0;
+    for(; begin != end; ++begin, ++j){
+      if(j % 64 == 0)
+	bits[j / 64] = 0;
+      if(*begin == 1)
+	bits[j / 64] |= uint64_t(1) << (j % 64);
+      else if(*begin != 0)
+	return false;
+    }
+    return true;
+  }
 
 }
 
@@ -1,314 +1,298 @@
 #ifndef _CLUSTEROL_DISSIMILARITY_MATRIX_H_
 #define _CLUSTEROL_DISSIMILARITY_MATRIX_H_
 
+#include "condensed_matrix.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
 #include <vector>
-#include <map>
 #include <utility>
 #include <iostream>
 #include <limits>
-#include <iterator>
 #include <stdexcept>
+#include <stdint.h>
 
 
-// A  dissimilarity matrix based on various STL-containers
+// A dissimilarity matrix with fast access to its minimum.
+// The entries live in a condensed_matrix (n(n-1)/2 values, no
+// per-pair overhead) or another storage with the same interface like
+// file_matrix, every row caches the minimum of the entries
+// behind it. A row is rescanned by min_pair only after its minimum
+// has been increased or erased.
+// With a storage that allows concurrent access (condensed_matrix),
+// update_row and the rescans of min_pair run in parallel for many
+// active rows. Results are the same as sequentially.
 
 namespace clusterol{
 
-  template <typename iterator>
-  struct const_key_iterator{
-    // bidirectional iterator which iterates over underlying iterator
-    // and returns it->first when dereferenced
-
-    typedef typename std::iterator_traits<iterator>::value_type it_value_type;
-    typedef typename it_value_type::first_type value_type;
-    typedef const value_type* pointer;
-    typedef const value_type& reference;
-    typedef std::bidirectional_iterator_tag iterator_category;
-  
-    const_key_iterator(iterator it_ = iterator()): it(it_) {}
-
-    bool operator==(const const_key_iterator<iterator>& other) const{
-      return it == other.it;
-    }
-
-    bool operator!=(const const_key_iterator<iterator>& other) const{
-      return it != other.it;
-    }
-
-    reference operator*() const{
-      return it->first;
-    }
-
-    pointer operator->() const{
-      return & it->first;
-    }
-
-    // prefix: reference, postfix: copy
-    const_key_iterator<iterator>& operator++(){
-      ++it;
-      return *this;
-    }
-
-    const_key_iterator<iterator> operator++(int postfix){
-      const_key_iterator<iterator> result = *this;
-      ++it;
-      return result;
-    }
-
-    const_key_iterator<iterator>& operator--(){
-      --it;
-      return *this;
-    }
-
-    const_key_iterator<iterator> operator--(int postfix){
-      const_key_iterator<iterator> result = *this;
-      --it;
-      return result;
-    }  
-
-  private:
-    iterator it;
-  };
+  // below this many active rows update_row and min_pair run sequentially
+  const size_t join_parallel_cutoff = 2048;
 
-
-  template <typename matrix_t, typename index_t, typename compare_t>
-  struct matrix_compare{
-    // compare indirectly by matrix entries
-    matrix_compare(const matrix_t& matrix_, compare_t compare_ = compare_t())
-      : matrix(matrix_), compare(compare_) {}
-
-    bool operator()(const std::pair<index_t, index_t>& a, const std::pair<index_t, index_t>& b){
-      return compare(matrix[a.first][a.second], matrix[b.first][b.second]);
-    }
-  
-  private:
-    const matrix_t& matrix;
-    compare_t compare;
-  };
-
-
-  template <typename dis_val = double, typename index_t = uint16_t>
+  template <typename dis_val = double, typename index_t = uint32_t, typename storage_t = condensed_matrix<dis_val, index_t> >
   class dissimilarity_matrix{
     // typedefs
   private:
-    typedef typename std::vector< std::vector<dis_val> > matrix_t;
-    typedef typename  std::multiset< std::pair<index_t, index_t>, matrix_compare<matrix_t, index_t, std::less<dis_val> > > set_t;
-    typedef std::vector< std::vector<typename set_t::iterator> > it_matrix_t;
+    typedef storage_t matrix_t;
   public:
-    typedef const_key_iterator< typename std::map<size_t, index_t>::const_iterator > id_iterator;
-
-    // exposesindex pairs without translation, debugging use only
-    // typedef typename set_t::iterator raw_sorted_pair_iterator;
+    typedef dis_val value_type;
+    typedef typename matrix_t::id_iterator id_iterator;
 
 
-    // Constructor:
-    //dissimilarity_matrix(size_t size);
-    //   // generate a dissimilarity_matrix filled with 0
-    //   // this would be very inefficient due to the multimap-generation
+    // Constructor, further arguments are passed on to the storage:
+    template <typename random_access_iterator, typename dissimilarity_t, typename... storage_args>
+    dissimilarity_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity, storage_args... args);
 
-    template <typename random_access_iterator, typename dissimilarity_t>
-    dissimilarity_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity);
 
-  
-    void print(std::ostream& os) const; 
+    void print(std::ostream& os) const;
     void update(size_t id_a, size_t id_b, dis_val value);
+    template <typename function>
+    void update_row(size_t id_a, size_t id_b, function new_value);
     void erase(size_t id);
+    std::pair<size_t, size_t> min_pair() const;
+
 
-  
     dis_val operator()(size_t id_a, size_t id_b) const{
-      size_t a = external_to_internal(id_a);
-      size_t b = external_to_internal(id_b);
-        
-      if(a > b)
-	return matrix[a][b];
-      else if(a < b)
-	return matrix[b][a];
-      else
-	return 0;			// id_a == id_b
+      // both ids must be valid, unchecked as it's called for every pair
+      return matrix(id_a, id_b);
     }
-  
+
     void move(size_t old_id, size_t new_id){
       // mv from old_id to new_id
-      // this changes the maps only.
-
-      size_t ind = external_to_internal(old_id);
-
-      external_to_internal_map.erase(old_id);
-      external_to_internal_map[new_id] = ind;
-      internal_to_external_map[ind] = new_id;
-    }    
-
-  
-    std::pair<index_t, index_t> min_pair() const{
-      // return minimum entry of dissimilarity matrix
-      std::pair<index_t, index_t> mp = *mset.begin();
-      return std::make_pair(internal_to_external(mp.first), internal_to_external(mp.second));
+      // this changes the id maps only.
+      matrix.move(old_id, new_id);
     }
 
 
     bool is_valid(size_t id) const{
       // return true, if id is a valid cluster id
-      return external_to_internal_map.count(id);
+      return matrix.is_valid(id);
     }
 
-  
+
     size_t valid() const{
       // get number of valid ids
-      return external_to_internal_map.size();
+      return matrix.valid();
     }
 
-  
+
     id_iterator id_begin() const{
       // iterate over ids
-      return id_iterator(external_to_internal_map.begin()); 
+      return matrix.id_begin();
     }
 
     id_iterator id_end() const{
-      return id_iterator(external_to_internal_map.end());
+      return matrix.id_end();
     }
 
-    // exposes internal ids, may still be useful for debugging
-    // raw_sorted_pair_iterator raw_sorted_begin() const{
-    //   // dangerous if matrix has been used for clustering, but fast otherwise
-    //   return mset.begin();
-    // }
-
-    // raw_sorted_pair_iterator raw_sorted_end() const{
-    //   return mset.end();
-    // }
-
   private:
-
-    // external / internal conversion
-    index_t external_to_internal(size_t id) const{
-      typename std::map<size_t, index_t>::const_iterator result_it =  external_to_internal_map.find(id);
-      // good for debugging:
-      if(result_it == external_to_internal_map.end())
-	throw std::runtime_error("invalid external id");
-
-      return result_it->second;
+    bool parallel() const{
+      // enough active rows and threads to split the work?
+      return matrix_t::concurrent_reads && valid() > join_parallel_cutoff && num_threads() > 1;
     }
 
-    size_t internal_to_external(index_t index) const{
-      return internal_to_external_map.find(index)->second;
+    size_t checked_row(size_t id) const{
+      // row of id, an invalid id is an error
+      if(!matrix.is_valid(id))
+	throw std::runtime_error("dissimilarity_matrix: invalid cluster id");
+      return matrix.row(id);
     }
 
+    void scan_row(size_t r) const;
+    void update_row_state(size_t r, size_t j, dis_val value);
 
-    std::map<size_t, index_t> external_to_internal_map; // id -> index
-    std::map<index_t, size_t> internal_to_external_map; // index -> id
-
-    set_t mset;			// (index, index) sorted
-    matrix_t matrix;		// index, index -> val
-    it_matrix_t it_matrix;	// index, index -> iterator
+    matrix_t matrix;
+    // minimum of row r is matrix.at(r, nn[r]) with nn[r] > r, unless
+    // stale[r]. mindist[r] is a lower bound of the row then.
+    mutable std::vector<index_t> nn;
+    mutable std::vector<dis_val> mindist;
+    mutable std::vector<char> stale;
   };
 
 
-  template <typename dis_val, typename index_t>
-  template <typename random_access_iterator, typename dissimilarity_t>
-  dissimilarity_matrix<dis_val, index_t>::dissimilarity_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity)
-    : mset(matrix)
+  template <typename dis_val, typename index_t, typename storage_t>
+  template <typename random_access_iterator, typename dissimilarity_t, typename... storage_args>
+  dissimilarity_matrix<dis_val, index_t, storage_t>::dissimilarity_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity, storage_args... args)
+    : matrix(data, data_end, dissimilarity, args...),
+      nn(matrix.size()),
+      mindist(matrix.size()),
+      stale(matrix.size(), 0)
   {
-    // calculate matrix from data with dissimilarity
-    using namespace std;
-
-    size_t size = distance(data, data_end);
-  
-    // get memory and set up maps
-    matrix.resize(size); it_matrix.resize(size);
-    for(size_t i = 0; i != size; ++i){
-      external_to_internal_map[i] = i;
-      internal_to_external_map[i] = i;
-      matrix[i].resize(i);
-      it_matrix[i].resize(i);
-    }
+    // calculate matrix from data with dissimilarity, then row minima
+    CLUSTEROL_PROFILE_SCOPE("dissimilarity_matrix");
+    CLUSTEROL_PROFILE_COUNT("allocated_bytes.dissimilarity_matrix", matrix.size() * (sizeof(index_t) + sizeof(dis_val) + 1));
+    CLUSTEROL_OMP(omp parallel for schedule(dynamic, 64) if(matrix_t::concurrent_reads))
+    for(size_t r = 0; r < matrix.size(); ++r)
+      scan_row(r);
+  }
+
 
-    // fill matrix and mset
-    for(size_t i = 0; i != size; ++i){
-      for(size_t j = 0; j != i; ++j){
-	matrix[i][j] = dissimilarity(data[i], data[j]);
+  template <typename dis_val, typename index_t, typename storage_t>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::scan_row(size_t r) const{
+    // find the minimum of row r, npos for the last active row
+    nn[r] = matrix_t::npos;
+    mindist[r] = std::numeric_limits<dis_val>::max();
+    matrix.hold_row(r);
+    for(size_t j = matrix.next_row(r); j != matrix_t::npos; j = matrix.next_row(j)){
+      if(nn[r] == matrix_t::npos || matrix.at(r, j) < mindist[r]){
+	mindist[r] = matrix.at(r, j);
+	nn[r] = j;
       }
     }
+    stale[r] = 0;
+  }
 
-    // two loops is better for cache and simd
-    for(size_t i = 0; i != size; ++i)
-      for(size_t j = 0; j != i; ++j)
-	it_matrix[i][j] =  mset.insert(make_pair(i, j));
 
-  } 
+  template <typename dis_val, typename index_t, typename storage_t>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::update(size_t id_a, size_t id_b, dis_val value){
+    // change entry (id_a, id_b) to value
+    if(id_a == id_b)
+      return;			// dis_mat(x, x) == 0
 
+    size_t a = checked_row(id_a);
+    size_t b = checked_row(id_b);
+    if(a > b)
+      std::swap(a, b);
 
-  template <typename dis_val, typename index_t>
-  void dissimilarity_matrix<dis_val, index_t>::update(size_t id_a, size_t id_b, dis_val value){
-    // change entry (id_a, id_b) to value
-    using namespace std;
+    matrix.at(a, b) = value;
+    update_row_state(a, b, value);
+  }
 
-    size_t a = external_to_internal(id_a);
-    size_t b = external_to_internal(id_b);
-        
-    if(a == b)
-      return;			// dis_mat(x, x) == 0
-    
-    if(a < b)
-      swap(a, b);
-
-    matrix[a][b] = value;
- 
-    // // insert with indication of the right position
-    // DON'T DO THIS! in rare cases something goes wrong.
-    // typename set_t::iterator old_pos = it_matrix[a][b];
-    // it_matrix[a][b] = mset.insert(old_pos, make_pair(a, b));
-    // mset.erase(old_pos);
-    // Standard says: (23.1.2)
-    // The insert members shall not affect the validity of iterators
-    // and references to the container, and the erase members shall
-    // invalidate only iterators and references to the erased
-    // elements.
-    // BUT:
-    // matrix[a][b] gets a new value above and is used in comparisons
-    // in the set. Inserting before erasing may result in a wrong
-    // order for the set.
-    
-    // without indication
-    mset.erase(it_matrix[a][b]);
-    it_matrix[a][b] = mset.insert(make_pair(a, b));
+
+  template <typename dis_val, typename index_t, typename storage_t>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::update_row_state(size_t r, size_t j, dis_val value){
+    // entry (r, j), r < j, was changed to value
+    if(value < mindist[r]){
+      // below the lower bound, this is the new row minimum
+      mindist[r] = value;
+      nn[r] = j;
+      stale[r] = 0;
+    }else if(nn[r] == j && value > mindist[r]){
+      stale[r] = 1;
+    }
   }
 
 
-  template <typename dis_val, typename index_t>
-  void dissimilarity_matrix<dis_val, index_t>::erase(size_t id){
+  template <typename dis_val, typename index_t, typename storage_t>
+  template <typename function>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::update_row(size_t id_a, size_t id_b, function new_value){
+    // Change every entry (id_a, id) to new_value(id), except for id_a
+    // and id_b, like update in order of the rows. new_value may read
+    // the matrix. In parallel rows r < row a keep their own state, the
+    // candidates behind row a are reduced per thread in row order
+    // (static schedule), so ties pick the same entry as sequentially.
+    size_t a = checked_row(id_a), b = checked_row(id_b);
+    if(!parallel()){
+      // row a is rewritten, new_value reads row b
+      matrix.hold_row(b);
+      for(size_t r = matrix.first_row(); r != matrix_t::npos; r = matrix.next_row(r)){
+	if(r == a || r == b)
+	  continue;
+	dis_val value = new_value(matrix.id(r));
+	if(r < a){
+	  matrix.at(a, r) = value;
+	  update_row_state(r, a, value);
+	}else{
+	  matrix.at(a, r) = value;
+	  update_row_state(a, r, value);
+	}
+      }
+      return;
+    }
+
+    index_t old_nn = nn[a];
+    dis_val old_min = mindist[a];
+    bool nn_increased = false;
+    std::vector<dis_val> thread_min(num_threads(), std::numeric_limits<dis_val>::max());
+    std::vector<size_t> thread_nn(num_threads(), matrix_t::npos);
+
+    CLUSTEROL_OMP(omp parallel)
+    {
+      dis_val my_min = std::numeric_limits<dis_val>::max();
+      size_t my_nn = matrix_t::npos;
+      CLUSTEROL_OMP(omp for schedule(static) nowait)
+      for(size_t r = 0; r < matrix.size(); ++r){
+	if(r == a || r == b || matrix.id(r) == matrix_t::npos)
+	  continue;
+	dis_val value = new_value(matrix.id(r));
+	if(r < a){
+	  matrix.at(r, a) = value;
+	  update_row_state(r, a, value);
+	}else{
+	  matrix.at(a, r) = value;
+	  if(my_nn == matrix_t::npos || value < my_min){
+	    my_min = value;
+	    my_nn = r;
+	  }
+	  if(r == old_nn && value > old_min)
+	    nn_increased = true;	// only one row writes
+	}
+      }
+      thread_min[thread_num()] = my_min;
+      thread_nn[thread_num()] = my_nn;
+    }
+
+    // the same outcome as update_row_state for each row behind a
+    size_t best = matrix_t::npos;
+    for(size_t t = 0; t != thread_nn.size(); ++t){
+      if(thread_nn[t] != matrix_t::npos && (best == matrix_t::npos || thread_min[t] < thread_min[best]))
+	best = t;
+    }
+    if(best != matrix_t::npos && thread_min[best] < old_min){
+      mindist[a] = thread_min[best];
+      nn[a] = thread_nn[best];
+      stale[a] = 0;
+    }else if(nn_increased){
+      stale[a] = 1;
+    }
+  }
+
+
+  template <typename dis_val, typename index_t, typename storage_t>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::erase(size_t id){
     // erase information related to id
+    size_t r = checked_row(id);
 
-    using namespace std;
+    for(size_t j = matrix.first_row(); j != r; j = matrix.next_row(j)){
+      if(nn[j] == r)
+	stale[j] = 1;
+    }
 
-    size_t ind = external_to_internal(id);
+    matrix.erase(id);
+  }
 
-    typedef typename map<index_t, size_t>::iterator it_type;
-    it_type ind_it = internal_to_external_map.find(ind);
 
-    // The lower triangle exists. Draw this on paper to understand.
-    // The two loops don't overlap
-    for(it_type j = internal_to_external_map.begin(); j != ind_it; ++j)
-      mset.erase(it_matrix[ind][j->first]);
+  template <typename dis_val, typename index_t, typename storage_t>
+  std::pair<size_t, size_t> dissimilarity_matrix<dis_val, index_t, storage_t>::min_pair() const{
+    // return minimum entry of dissimilarity matrix
+    CLUSTEROL_PROFILE_SCOPE("min_pair");
+    size_t n_scan = 0;
+    if(parallel()){
+      // rescan rows with stale minima first, each row writes only its own
+      CLUSTEROL_OMP(omp parallel for schedule(dynamic, 16) reduction(+:n_scan))
+      for(size_t r = 0; r < matrix.size(); ++r){
+	if(stale[r] && matrix.id(r) != matrix_t::npos){
+	  scan_row(r);
+	  ++n_scan;
+	}
+      }
+    }
 
-    it_type begin = ind_it; ++begin;
-    for(it_type i = begin; i != internal_to_external_map.end(); ++i)
-      mset.erase(it_matrix[i->first][ind]);
-    
-    // // save some ram
-    it_matrix[ind].clear();
-    matrix[ind].clear();
+    size_t best = matrix_t::npos;
+    for(size_t r = matrix.first_row(); r != matrix_t::npos; r = matrix.next_row(r)){
+      if(stale[r]){
+	scan_row(r);
+	++n_scan;
+      }
+      if(nn[r] != matrix_t::npos && (best == matrix_t::npos || mindist[r] < mindist[best]))
+	best = r;
+    }
+    CLUSTEROL_PROFILE_COUNT("row_scans", n_scan);
 
-    // really save ram
-    typename it_matrix_t::value_type().swap(it_matrix[ind]);
-    typename matrix_t::value_type().swap(matrix[ind]);
-  
-    internal_to_external_map.erase(ind_it);
-    external_to_internal_map.erase(id); // key not iterator, optimisation possible
+    return std::make_pair(size_t(matrix.id(best)), size_t(matrix.id(nn[best])));
   }
 
 
-  template <typename dis_val, typename index_t>
-  void dissimilarity_matrix<dis_val, index_t>::print(std::ostream& os) const{
+  template <typename dis_val, typename index_t, typename storage_t>
+  void dissimilarity_matrix<dis_val, index_t, storage_t>::print(std::ostream& os) const{
     // print the matrix and some more
     for(id_iterator i = id_begin(); i != id_end(); ++i){
       for(id_iterator j = id_begin(); j != id_end(); ++j)
@@ -316,17 +300,19 @@ namespace clusterol{
       os << "\n";
     }
 
-    for(typename set_t::const_iterator i = mset.begin(); i != mset.end(); ++i){
-      os << "(" << i->first << ", " << i->second << ")\t";
-      os << matrix[i->first][i->second] << "\n";
+    for(size_t r = matrix.first_row(); r != matrix_t::npos; r = matrix.next_row(r)){
+      os << r << ": (" << matrix.id(r) << ", ";
+      if(nn[r] != matrix_t::npos)
+	os << matrix.id(nn[r]);
+      os << ")\t" << mindist[r] << (stale[r] ? "\tstale" : "") << "\n";
     }
-    
+
     os << "\n";
   }
 
 
-  template <typename dis_val, typename index_t>
-  std::ostream& operator<<(std::ostream& os, const dissimilarity_matrix<dis_val, index_t> & dis_mat){
+  template <typename dis_val, typename index_t, typename storage_t>
+  std::ostream& operator<<(std::ostream& os, const dissimilarity_matrix<dis_val, index_t, storage_t> & dis_mat){
     // cout << dissimilarity_matrix
     dis_mat.print(os);
     return os;
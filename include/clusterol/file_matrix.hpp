@@ -0,0 +1,353 @@
+#ifndef _CLUSTEROL_FILE_MATRIX_H_
+#define _CLUSTEROL_FILE_MATRIX_H_
+
+#include "condensed_matrix.hpp"
+#include "parallel.hpp"
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <stdint.h>
+#include <unistd.h>
+
+
+// An out-of-core dissimilarity matrix: the same interface as
+// condensed_matrix, but the entries live in a scratch file and only
+// a bounded number of rows is kept in memory.
+// The file holds the full symmetric matrix row by row, twice the
+// size of the triangle, so that all entries of a row are contiguous.
+// Writing to a row that is only in the file makes it a recent row:
+// it is read, kept in memory and from then on holds the valid copy
+// of its entries with every row rewritten before it (by stamp). The
+// copies in the other rows are brought up to date in one pass over
+// the file (flush) when no recent row fits into memory anymore.
+// A merge thus reads rows a and b and the rescanned rows, n entries
+// each, and every memory_limit / (n sizeof(dis_val)) rewritten rows
+// the whole file is read and written once.
+// Not thread-safe, even for reads.
+
+namespace clusterol{
+
+  template <typename dis_val = double, typename index_t = uint32_t>
+  class file_matrix{
+  public:
+    typedef dis_val value_type;
+    typedef index_t index_type;
+    typedef row_id_iterator< file_matrix<dis_val, index_t> > id_iterator;
+    static const index_t npos = index_t(-1);
+    static const bool concurrent_reads = false;
+
+    // memory_limit: bytes for the rows in memory, at least 4 rows.
+    // scratch_dir: directory of the (unlinked) scratch file, "" uses
+    // $TMPDIR or /tmp.
+    template <typename random_access_iterator, typename dissimilarity_t>
+    file_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity,
+		size_t memory_limit, const std::string& scratch_dir = "");
+
+    ~file_matrix(){
+      close(fd);
+    }
+
+
+    // row access, a != b
+    dis_val& at(size_t a, size_t b){
+      // the copy of the row rewritten last, row a if both are only
+      // in the file
+      if(stamp[a] < stamp[b])
+	std::swap(a, b);
+      if(stamp[a] == 0)
+	rewrite(a);
+      return recent[recent_slot[a]][b];
+    }
+
+    dis_val at(size_t a, size_t b) const{
+      if(stamp[a] < stamp[b])
+	std::swap(a, b);
+      if(stamp[a] != 0)
+	return recent[recent_slot[a]][b];
+      // both rows are only in the file, where their copies agree
+      if(held == b)
+	std::swap(a, b);
+      if(held == a)
+	return held_value[b];
+      dis_val value;
+      read(a * n + b, 1, &value);
+      return value;
+    }
+
+    void hold_row(size_t r) const{
+      // row r is read against most other rows next, keep it at hand
+      if(stamp[r] == 0 && held != r){
+	held = npos;
+	read(r * n, n, &held_value[0]);
+	held = r;
+      }
+    }
+
+    index_t first_row() const{
+      return rows.first_row();
+    }
+
+    index_t next_row(size_t r) const{
+      return rows.next_row(r);
+    }
+
+    index_t row(size_t id) const{
+      return rows.row(id);
+    }
+
+    index_t id(size_t r) const{
+      return rows.id(r);
+    }
+
+
+    // id access, like dissimilarity_matrix
+    dis_val operator()(size_t id_a, size_t id_b) const{
+      if(id_a == id_b)
+	return 0;
+      return at(rows.row(id_a), rows.row(id_b));
+    }
+
+    void update(size_t id_a, size_t id_b, dis_val value){
+      if(id_a != id_b)
+	at(rows.row(id_a), rows.row(id_b)) = value;
+    }
+
+    void erase(size_t id){
+      // the row is never read again
+      size_t r = rows.row(id);
+      if(stamp[r] != 0){
+	recent_row[recent_slot[r]] = npos;
+	free_slot.push_back(recent_slot[r]);
+	recent_slot[r] = npos;
+	stamp[r] = 0;
+      }
+      if(held == r)
+	held = npos;
+      rows.erase(id);
+    }
+
+    void move(size_t old_id, size_t new_id){
+      rows.move(old_id, new_id);
+    }
+
+    bool is_valid(size_t id) const{
+      return rows.is_valid(id);
+    }
+
+    size_t valid() const{
+      return rows.valid();
+    }
+
+    size_t size() const{
+      // number of rows, including erased ones
+      return rows.size();
+    }
+
+    id_iterator id_begin() const{
+      // iterate over ids
+      return id_iterator(this, first_row());
+    }
+
+    id_iterator id_end() const{
+      return id_iterator(this, npos);
+    }
+
+  private:
+    file_matrix(const file_matrix&);
+    file_matrix& operator=(const file_matrix&);
+
+    void rewrite(size_t r);
+    void flush();
+    void read(size_t index, size_t count, dis_val* value) const;
+    void write(size_t index, size_t count, const dis_val* value) const;
+
+    size_t n;
+    active_rows<index_t> rows;
+    int fd;
+
+    // recent rows: stamp 0 for rows only in the file
+    std::vector<size_t> stamp;
+    size_t clock;
+    std::vector<index_t> recent_slot;		// npos: not recent
+    std::vector< std::vector<dis_val> > recent;
+    std::vector<index_t> recent_row;		// of each slot, npos: free
+    std::vector<index_t> free_slot;
+
+    // a row only in the file, see hold_row
+    mutable size_t held;
+    mutable std::vector<dis_val> held_value;
+  };
+
+
+  template <typename dis_val, typename index_t>
+  const index_t file_matrix<dis_val, index_t>::npos;
+
+  template <typename dis_val, typename index_t>
+  const bool file_matrix<dis_val, index_t>::concurrent_reads;
+
+
+  template <typename dis_val, typename index_t>
+  template <typename random_access_iterator, typename dissimilarity_t>
+  file_matrix<dis_val, index_t>::file_matrix(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity,
+					     size_t memory_limit, const std::string& scratch_dir)
+    : n(std::distance(data, data_end)),
+      rows(n),
+      fd(-1),
+      stamp(n, 0),
+      clock(0),
+      recent_slot(n, npos),
+      held(npos),
+      held_value(n)
+  {
+    // calculate all rows from data with dissimilarity into the
+    // scratch file
+    CLUSTEROL_PROFILE_SCOPE("file_matrix");
+    CLUSTEROL_PROFILE_COUNT("distance_calls", n > 1 ? n * (n - 1) / 2 : 0);
+    std::string dir = scratch_dir;
+    if(dir.empty())
+      dir = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+    std::string filename = dir + "/clusterol-XXXXXX";
+    std::vector<char> name(filename.begin(), filename.end());
+    name.push_back('\0');
+    fd = mkstemp(&name[0]);
+    if(fd == -1)
+      throw std::runtime_error("file_matrix: could not create a scratch file in " + dir);
+    unlink(&name[0]);		// removed when closed
+
+    // one row is held, the others are recent or a block of rows
+    // while the file is written
+    size_t max_row = std::max<size_t>(4, memory_limit / (std::max<size_t>(n, 1) * sizeof(dis_val)));
+    size_t max_recent = std::min(max_row - 1, n);
+    recent.resize(max_recent);
+    recent_row.resize(max_recent, npos);
+    for(size_t s = max_recent; s-- > 0; )
+      free_slot.push_back(s);
+
+    try{
+      // The entries left of a block of rows are in the columns of the
+      // rows written before, the ones right of the diagonal are
+      // calculated in parallel.
+      size_t block = std::min(max_row - 1, std::max<size_t>(n, 1));
+      std::vector<dis_val> value(block * n), column(block);
+      for(size_t r_begin = 0; r_begin < n; r_begin += block){
+	size_t m = std::min(block, n - r_begin);
+	for(size_t j = 0; j < r_begin; ++j){
+	  read(j * n + r_begin, m, &column[0]);
+	  for(size_t i = 0; i < m; ++i)
+	    value[i * n + j] = column[i];
+	}
+	CLUSTEROL_OMP(omp parallel for schedule(dynamic) firstprivate(dissimilarity))
+	for(size_t i = 0; i < m; ++i){
+	  size_t r = r_begin + i;
+	  value[i * n + r] = 0;
+	  for(size_t j = r + 1; j < n; ++j)
+	    value[i * n + j] = dissimilarity(data[r], data[j]);
+	}
+	for(size_t i = 0; i < m; ++i)
+	  for(size_t k = 0; k < i; ++k)
+	    value[i * n + r_begin + k] = value[k * n + r_begin + i];
+	write(r_begin * n, m * n, &value[0]);
+      }
+    }catch(std::exception&){
+      close(fd);
+      throw std::runtime_error("file_matrix: could not write the scratch file in " + dir);
+    }
+  }
+
+
+  template <typename dis_val, typename index_t>
+  void file_matrix<dis_val, index_t>::rewrite(size_t r){
+    // make row r, only in the file so far, the most recent row
+    if(free_slot.empty())
+      flush();
+    index_t s = free_slot.back();
+    free_slot.pop_back();
+    std::vector<dis_val>& value = recent[s];
+    if(held == r){
+      value.swap(held_value);
+      held_value.resize(n);
+      held = npos;
+    }else{
+      value.resize(n);
+      read(r * n, n, &value[0]);
+    }
+    // all recent rows are newer than r
+    for(size_t t = 0; t != recent_row.size(); ++t){
+      if(recent_row[t] != npos)
+	value[recent_row[t]] = recent[t][r];
+    }
+    recent_slot[r] = s;
+    recent_row[s] = r;
+    stamp[r] = ++clock;
+  }
+
+
+  template <typename dis_val, typename index_t>
+  void file_matrix<dis_val, index_t>::flush(){
+    // write the valid copies into all active rows of the file, one
+    // row after the other
+    CLUSTEROL_PROFILE_SCOPE("file_matrix.flush");
+    std::vector<dis_val> buffer(n);
+    for(size_t r = rows.first_row(); r != npos; r = rows.next_row(r)){
+      std::vector<dis_val>* value = &buffer;
+      if(stamp[r] != 0)
+	value = &recent[recent_slot[r]];
+      else
+	read(r * n, n, &buffer[0]);
+      for(size_t t = 0; t != recent_row.size(); ++t){
+	if(recent_row[t] != npos && stamp[recent_row[t]] > stamp[r])
+	  (*value)[recent_row[t]] = recent[t][r];
+      }
+      write(r * n, n, &(*value)[0]);
+    }
+
+    free_slot.clear();
+    for(size_t t = recent_row.size(); t-- > 0; ){
+      if(recent_row[t] != npos){
+	recent_slot[recent_row[t]] = npos;
+	stamp[recent_row[t]] = 0;
+	recent_row[t] = npos;
+      }
+      free_slot.push_back(t);
+    }
+    held = npos;
+  }
+
+
+  template <typename dis_val, typename index_t>
+  void file_matrix<dis_val, index_t>::read(size_t index, size_t count, dis_val* value) const{
+    // count entries from entry index (row * n + column) on
+    char* p = reinterpret_cast<char*>(value);
+    size_t left = count * sizeof(dis_val);
+    off_t offset = off_t(index) * off_t(sizeof(dis_val));
+    while(left > 0){
+      ssize_t r = pread(fd, p, left, offset);
+      if(r <= 0)
+	throw std::runtime_error("file_matrix: could not read the scratch file");
+      p += r;
+      left -= r;
+      offset += r;
+    }
+  }
+
+
+  template <typename dis_val, typename index_t>
+  void file_matrix<dis_val, index_t>::write(size_t index, size_t count, const dis_val* value) const{
+    const char* p = reinterpret_cast<const char*>(value);
+    size_t left = count * sizeof(dis_val);
+    off_t offset = off_t(index) * off_t(sizeof(dis_val));
+    while(left > 0){
+      ssize_t r = pwrite(fd, p, left, offset);
+      if(r <= 0)
+	throw std::runtime_error("file_matrix: could not write the scratch file");
+      p += r;
+      left -= r;
+      offset += r;
+    }
+  }
+
+}
+
+#endif /* _CLUSTEROL_FILE_MATRIX_H_ */
@@ -0,0 +1,217 @@
+#ifndef _CLUSTEROL_GENERIC_LINKAGE_H_
+#define _CLUSTEROL_GENERIC_LINKAGE_H_
+
+#include "dendrogram.hpp"
+#include "lance_williams.hpp"
+#include "condensed_matrix.hpp"
+#include "profile.hpp"
+#include <vector>
+
+
+// Clustering for any Lance-Williams method on a condensed_matrix.
+// Every row caches its nearest neighbor among the rows behind it and
+// a lower bound of that distance. The rows are kept in a heap ordered
+// by the lower bound, a row is only rescanned when its cached minimum
+// turns out to be stale. Merges happen in the same order as with
+// matrix_cluster, so centroid and median (not reducible) work.
+// Lit: Muellner, "Modern hierarchical, agglomerative clustering
+// algorithms", 2011, generic_linkage.
+
+namespace clusterol{
+
+  template <typename key_type>
+  class indexed_min_heap{
+    // binary heap of indices 0..n-1, ordered by key[index]
+    // keys are stored outside, change them only through update_*
+  public:
+    indexed_min_heap(std::vector<key_type>& key_, size_t n)
+      : key(key_), heap(n), pos(n)
+    {
+      for(size_t i = 0; i != n; ++i){
+	heap[i] = i;
+	pos[i] = i;
+      }
+      for(size_t i = n / 2; i-- > 0;)
+	sift_down(i);
+    }
+
+    size_t argmin() const{
+      return heap[0];
+    }
+
+    void pop(){
+      // remove argmin
+      swap_nodes(0, heap.size() - 1);
+      heap.pop_back();
+      if(!heap.empty())
+	sift_down(0);
+    }
+
+    void update_leq(size_t i, key_type value){
+      // value <= key[i]
+      key[i] = value;
+      sift_up(pos[i]);
+    }
+
+    void update_geq(size_t i, key_type value){
+      // value >= key[i]
+      key[i] = value;
+      sift_down(pos[i]);
+    }
+
+    void update(size_t i, key_type value){
+      if(value <= key[i])
+	update_leq(i, value);
+      else
+	update_geq(i, value);
+    }
+
+  private:
+    void swap_nodes(size_t a, size_t b){
+      std::swap(heap[a], heap[b]);
+      pos[heap[a]] = a;
+      pos[heap[b]] = b;
+    }
+
+    void sift_up(size_t p){
+      while(p > 0){
+	size_t parent = (p - 1) / 2;
+	if(!(key[heap[p]] < key[heap[parent]]))
+	  break;
+	swap_nodes(p, parent);
+	p = parent;
+      }
+    }
+
+    void sift_down(size_t p){
+      for(;;){
+	size_t child = 2 * p + 1;
+	if(child >= heap.size())
+	  break;
+	if(child + 1 < heap.size() && key[heap[child + 1]] < key[heap[child]])
+	  ++child;
+	if(!(key[heap[child]] < key[heap[p]]))
+	  break;
+	swap_nodes(p, child);
+	p = child;
+      }
+    }
+
+    std::vector<key_type>& key;
+    std::vector<size_t> heap;	// position -> index
+    std::vector<size_t> pos;	// index -> position
+  };
+
+
+  template <typename height_type, typename lance_williams>
+  void generic_linkage(condensed_matrix<height_type>& dis_mat, dendrogram<height_type>& dend, lance_williams lw,
+		       const stop_criterion& stop = stop_criterion()){
+    // Cluster all rows of dis_mat into dend, until stop says so.
+    // The merged cluster of rows a < b is kept in row b, so the last
+    // row is never erased and every other active row has an active
+    // row behind it.
+    typedef condensed_matrix<height_type> matrix_t;
+    typedef typename dendrogram<height_type>::vertex_descriptor vertex_descriptor;
+
+    CLUSTEROL_PROFILE_SCOPE("generic_linkage");
+    size_t n = dis_mat.size();
+    if(n < 2)
+      return;
+
+    // nearest neighbor and lower bound of rows 0..n-2
+    std::vector<size_t> nn(n - 1);
+    std::vector<height_type> mindist(n - 1);
+    for(size_t i = 0; i != n - 1; ++i){
+      nn[i] = i + 1;
+      mindist[i] = dis_mat.at(i, i + 1);
+      for(size_t j = i + 2; j < n; ++j){
+	if(dis_mat.at(i, j) < mindist[i]){
+	  mindist[i] = dis_mat.at(i, j);
+	  nn[i] = j;
+	}
+      }
+    }
+    indexed_min_heap<height_type> heap(mindist, n - 1);
+
+    while(dis_mat.valid() > 1){
+      // find the true minimum, rescan rows with stale minima
+      size_t a = heap.argmin();
+      while(mindist[a] < dis_mat.at(a, nn[a])){
+	size_t j = dis_mat.next_row(a);
+	height_type min = dis_mat.at(a, j);
+	nn[a] = j;
+	for(j = dis_mat.next_row(j); j != matrix_t::npos; j = dis_mat.next_row(j)){
+	  if(dis_mat.at(a, j) < min){
+	    min = dis_mat.at(a, j);
+	    nn[a] = j;
+	  }
+	}
+	heap.update_geq(a, min);
+	a = heap.argmin();
+      }
+      size_t b = nn[a];
+      if(stop(dis_mat.valid(), dis_mat.at(a, b)))
+	break;
+      heap.pop();
+
+      // insert into dendrogram
+      size_t id_a = dis_mat.id(a);
+      size_t id_b = dis_mat.id(b);
+      vertex_descriptor parent = dend.join(id_a, id_b, dis_mat.at(a, b));
+
+      // update dis_mat(b, *) and the cached neighbors
+      CLUSTEROL_PROFILE_COUNT("lance_williams_evaluations", dis_mat.valid() - 2);
+      size_t j = dis_mat.first_row();
+      for(; j < a; j = dis_mat.next_row(j)){
+	height_type new_val = lw(dis_mat.id(j), id_a, id_b, dis_mat);
+	dis_mat.at(j, b) = new_val;
+	if(new_val < mindist[j]){
+	  heap.update_leq(j, new_val);
+	  nn[j] = b;
+	}else if(nn[j] == a){
+	  nn[j] = b;		// mindist[j] stays a lower bound
+	}
+      }
+      for(j = dis_mat.next_row(a); j < b; j = dis_mat.next_row(j)){
+	height_type new_val = lw(dis_mat.id(j), id_a, id_b, dis_mat);
+	dis_mat.at(j, b) = new_val;
+	if(new_val < mindist[j]){
+	  heap.update_leq(j, new_val);
+	  nn[j] = b;
+	}
+      }
+      if(b < n - 1){
+	// row b is rescanned completely
+	j = dis_mat.next_row(b);
+	height_type min = lw(dis_mat.id(j), id_a, id_b, dis_mat);
+	dis_mat.at(b, j) = min;
+	nn[b] = j;
+	for(j = dis_mat.next_row(j); j != matrix_t::npos; j = dis_mat.next_row(j)){
+	  height_type new_val = lw(dis_mat.id(j), id_a, id_b, dis_mat);
+	  dis_mat.at(b, j) = new_val;
+	  if(new_val < min){
+	    min = new_val;
+	    nn[b] = j;
+	  }
+	}
+	heap.update(b, min);
+      }
+
+      dis_mat.erase(id_a);
+      dis_mat.move(id_b, parent);
+    }
+  }
+
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+  void generic_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d, lance_williams lw,
+		       const stop_criterion& stop = stop_criterion()){
+    // Cluster with cached nearest neighbors. If lance_williams needs
+    // to access property maps of dend, dend can not be generated here.
+    condensed_matrix<height_type> dis_mat(data, data_end, d);
+    generic_linkage(dis_mat, dend, lw, stop);
+  }
+
+}
+
+#endif /* _CLUSTEROL_GENERIC_LINKAGE_H_ */
@@ -0,0 +1,323 @@
+#ifndef _CLUSTEROL_GEOMETRIC_H_
+#define _CLUSTEROL_GEOMETRIC_H_
+
+#include "dendrogram.hpp"
+#include "kd_tree.hpp"
+#include "kernels.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
+#include <vector>
+#include <queue>
+#include <limits>
+
+
+// Ward, centroid and median clustering of Euclidean data points from
+// cluster centroids: O(n d) memory instead of a dissimilarity matrix.
+// A cluster is a centroid and a size (median: the midpoint of the
+// centroids of its parts, Gower's weighted centroid). A merge creates
+// a new cluster, so dissimilarities never change. They equal the
+// Lance-Williams updates on squared Euclidean distances (e.g. ward
+// with squared_euclidean_distance):
+//   ward      2 |a| |b| / (|a| + |b|) ||c_a - c_b||^2
+//   centroid  ||c_a - c_b||^2
+//   median    ||c_a - c_b||^2
+// Candidates come from a kd-tree of the data points. A merged centroid
+// is a convex combination of its parts and lies in every box that
+// contains both, so it is stored at the lowest common ancestor of
+// their nodes and the boxes stay valid. Every cluster caches its
+// nearest neighbor, a heap orders the clusters by that dissimilarity.
+// A cache whose neighbor was merged is refreshed when it reaches the
+// top, the top of the heap is always the closest pair (this makes the
+// non-reducible centroid and median work, like generic_linkage).
+// Equal data points that share a kd-tree leaf are merged up front at
+// height 0, their centroid stays the same.
+// Lit: Muellner, "Modern hierarchical, agglomerative clustering
+// algorithms", 2011, section on geometric methods.
+
+namespace clusterol{
+
+  enum geometric_method{
+    geometric_ward,
+    geometric_centroid,
+    geometric_median
+  };
+
+
+  template <typename height_type = double>
+  class geometric_linkage{
+  public:
+    template <typename random_access_iterator>
+    geometric_linkage(random_access_iterator data, random_access_iterator data_end, geometric_method method_, size_t leaf_size = 16);
+
+    void run(dendrogram<height_type>& dend, const stop_criterion& stop = stop_criterion());
+
+  private:
+    static const size_t npos = size_t(-1);
+
+    struct candidate{
+      height_type dissimilarity;
+      size_t id, slot;
+
+      bool operator>(const candidate& other) const{
+	return dissimilarity > other.dissimilarity || (dissimilarity == other.dissimilarity && id > other.id);
+      }
+    };
+
+    height_type dissimilarity(size_t a, size_t b) const{
+      double d2 = kernel::squared_euclidean<double>(&centroid[a * d], &centroid[b * d], d);
+      if(method == geometric_ward)
+	d2 *= 2 * double(size[a]) * size[b] / (size[a] + size[b]);
+      return d2;
+    }
+
+    void nearest_neighbor(size_t s, std::vector<size_t>& stack);
+    void insert(size_t s, size_t nd);
+    void remove(size_t s);
+    size_t common_ancestor(size_t a, size_t b) const;
+
+    kd_tree<double> tree;
+    size_t n, d;
+    geometric_method method;
+
+    // clusters by slot, a merged cluster takes the slot of one part
+    std::vector<double> centroid;	// n x d
+    std::vector<size_t> id, size;
+    std::vector<bool> alive;
+    std::vector<size_t> nn, nn_id;
+    std::vector<height_type> nn_dissimilarity;
+    std::vector<size_t> node, node_pos;	// resident node and position there
+
+    // kd-tree nodes
+    std::vector<size_t> parent, depth, n_alive;
+    std::vector< std::vector<size_t> > resident;
+  };
+
+
+  template <typename height_type>
+  const size_t geometric_linkage<height_type>::npos;
+
+
+  template <typename height_type>
+  template <typename random_access_iterator>
+  geometric_linkage<height_type>::geometric_linkage(random_access_iterator data, random_access_iterator data_end, geometric_method method_,
+						   size_t leaf_size)
+    : tree(data, data_end, leaf_size),
+      n(tree.size()),
+      d(tree.dim()),
+      method(method_),
+      centroid(n * d),
+      id(n),
+      size(n, 1),
+      alive(n, true),
+      nn(n, npos),
+      nn_id(n, npos),
+      nn_dissimilarity(n),
+      node(n),
+      node_pos(n),
+      parent(tree.n_node(), npos),
+      depth(tree.n_node(), 0),
+      n_alive(tree.n_node(), 0),
+      resident(tree.n_node())
+  {
+    // slot k is the k-th point of the tree, it starts in its leaf
+    for(size_t k = 0; k != n; ++k){
+      std::copy(tree.point(k), tree.point(k) + d, &centroid[k * d]);
+      id[k] = tree.index(k);
+    }
+
+    // children have larger indices than their parents
+    for(size_t i = 0; i != tree.n_node(); ++i){
+      if(!tree.is_leaf(i)){
+	parent[tree[i].left] = parent[tree[i].right] = i;
+	depth[tree[i].left] = depth[tree[i].right] = depth[i] + 1;
+      }else{
+	for(size_t k = tree[i].begin; k != tree[i].end; ++k)
+	  insert(k, i);
+      }
+    }
+  }
+
+
+  template <typename height_type>
+  void geometric_linkage<height_type>::insert(size_t s, size_t nd){
+    // make slot s a resident of node nd
+    node[s] = nd;
+    node_pos[s] = resident[nd].size();
+    resident[nd].push_back(s);
+    for(size_t i = nd; i != npos; i = parent[i])
+      ++n_alive[i];
+  }
+
+
+  template <typename height_type>
+  void geometric_linkage<height_type>::remove(size_t s){
+    std::vector<size_t>& r = resident[node[s]];
+    r[node_pos[s]] = r.back();
+    node_pos[r.back()] = node_pos[s];
+    r.pop_back();
+    for(size_t i = node[s]; i != npos; i = parent[i])
+      --n_alive[i];
+  }
+
+
+  template <typename height_type>
+  size_t geometric_linkage<height_type>::common_ancestor(size_t a, size_t b) const{
+    while(depth[a] > depth[b])
+      a = parent[a];
+    while(depth[b] > depth[a])
+      b = parent[b];
+    while(a != b){
+      a = parent[a];
+      b = parent[b];
+    }
+    return a;
+  }
+
+
+  template <typename height_type>
+  void geometric_linkage<height_type>::nearest_neighbor(size_t s, std::vector<size_t>& stack){
+    // Set the nearest neighbor of slot s, ties prefer the smaller id.
+    // A box is skipped if no cluster in it can be closer: for ward the
+    // factor 2 |a| |b| / (|a| + |b|) is at least 2 |a| / (|a| + 1).
+    const double* c = &centroid[s * d];
+    double factor = method == geometric_ward ? 2 * double(size[s]) / (size[s] + 1) : 1;
+    size_t best = npos;
+    height_type best_dissimilarity = std::numeric_limits<height_type>::infinity();
+
+    stack.clear();
+    stack.push_back(0);
+    while(!stack.empty()){
+      size_t i = stack.back();
+      stack.pop_back();
+      if(n_alive[i] == 0 || factor * tree.point_box_distance2(c, i) > best_dissimilarity)
+	continue;
+
+      for(size_t k = 0; k != resident[i].size(); ++k){
+	size_t r = resident[i][k];
+	if(r == s)
+	  continue;
+	height_type x = dissimilarity(s, r);
+	if(x < best_dissimilarity || (x == best_dissimilarity && best != npos && id[r] < id[best])){
+	  best_dissimilarity = x;
+	  best = r;
+	}
+      }
+
+      if(!tree.is_leaf(i)){
+	// visit the nearer child first
+	size_t near = tree[i].left, far = tree[i].right;
+	if(tree.point_box_distance2(c, far) < tree.point_box_distance2(c, near))
+	  std::swap(near, far);
+	stack.push_back(far);
+	stack.push_back(near);
+      }
+    }
+
+    nn[s] = best;
+    nn_id[s] = best != npos ? id[best] : npos;
+    nn_dissimilarity[s] = best_dissimilarity;
+  }
+
+
+  template <typename height_type>
+  void geometric_linkage<height_type>::run(dendrogram<height_type>& dend, const stop_criterion& stop){
+    // cluster all data points into dend, until stop says so
+    CLUSTEROL_PROFILE_SCOPE("geometric_linkage");
+    if(n < 2)
+      return;
+
+    // Equal data points of a leaf (kd_tree's all_equal) are merged
+    // first, at height 0, into the first slot of the leaf. Otherwise
+    // each of their nearest neighbor searches scans all the others.
+    size_t n_cluster = n;
+    for(size_t i = 0; i != tree.n_node(); ++i){
+      if(!tree.is_leaf(i) || !tree[i].all_equal)
+	continue;
+      size_t a = tree[i].begin;
+      for(size_t k = a + 1; k != tree[i].end; ++k){
+	if(stop(n_cluster, height_type(0)))
+	  return;
+	id[a] = dend.join(id[a], id[k], height_type(0));
+	size[a] += size[k];
+	remove(k);
+	alive[k] = false;
+	--n_cluster;
+      }
+    }
+    if(n_cluster < 2)
+      return;
+
+    std::vector<size_t> stack;
+    CLUSTEROL_OMP(omp parallel for schedule(dynamic, 256) firstprivate(stack))
+    for(size_t s = 0; s < n; ++s){
+      if(alive[s])
+	nearest_neighbor(s, stack);
+    }
+
+    std::priority_queue<candidate, std::vector<candidate>, std::greater<candidate> > heap;
+    for(size_t s = 0; s != n; ++s){
+      if(alive[s]){
+	candidate c = {nn_dissimilarity[s], id[s], s};
+	heap.push(c);
+      }
+    }
+
+    while(n_cluster > 1){
+      candidate top = heap.top();
+      heap.pop();
+      size_t a = top.slot;
+      if(!alive[a] || id[a] != top.id)
+	continue;		// merged already
+      size_t b = nn[a];
+      if(!alive[b] || id[b] != nn_id[a]){
+	// the neighbor was merged, nothing else can be closer than before
+	nearest_neighbor(a, stack);
+	candidate c = {nn_dissimilarity[a], id[a], a};
+	heap.push(c);
+	continue;
+      }
+
+      if(stop(n_cluster, nn_dissimilarity[a]))
+	break;
+
+      // the merged cluster takes slot a
+      size_t parent_id = dend.join(id[a], id[b], nn_dissimilarity[a]);
+      double* ca = &centroid[a * d];
+      const double* cb = &centroid[b * d];
+      double wa = 0.5, wb = 0.5;
+      if(method != geometric_median){
+	wa = double(size[a]) / (size[a] + size[b]);
+	wb = double(size[b]) / (size[a] + size[b]);
+      }
+      for(size_t j = 0; j != d; ++j)
+	ca[j] = wa * ca[j] + wb * cb[j];
+
+      size_t nd = common_ancestor(node[a], node[b]);
+      remove(a);
+      remove(b);
+      alive[b] = false;
+      id[a] = parent_id;
+      size[a] += size[b];
+      insert(a, nd);
+      --n_cluster;
+
+      if(n_cluster > 1){
+	nearest_neighbor(a, stack);
+	candidate c = {nn_dissimilarity[a], id[a], a};
+	heap.push(c);
+      }
+    }
+  }
+
+
+  template <typename height_type, typename random_access_iterator>
+  void geometric_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, geometric_method method,
+			 const stop_criterion& stop = stop_criterion()){
+    // ward, centroid or median of Euclidean data points without a
+    // dissimilarity matrix, heights are squared Euclidean (see above)
+    geometric_linkage<height_type>(data, data_end, method).run(dend, stop);
+  }
+
+}
+
+#endif /* _CLUSTEROL_GEOMETRIC_H_ */
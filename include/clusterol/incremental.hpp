@@ -0,0 +1,362 @@
+#ifndef _CLUSTEROL_INCREMENTAL_H_
+#define _CLUSTEROL_INCREMENTAL_H_
+
+#include "dendrogram.hpp"
+#include "minimum_spanning_tree.hpp"
+#include "parallel.hpp"
+#include "union_find.hpp"
+#include "profile.hpp"
+#include <boost/graph/adjacency_list.hpp>
+#include <vector>
+#include <queue>
+#include <limits>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+
+
+// Single link of a growing set of data points. The state is the
+// minimum spanning tree, its edges sorted stably by weight (the merge
+// order), and the dendrogram built from them. Adding k data points to
+// n computes only the n k + k (k - 1) / 2 dissimilarities with a new
+// data point: a pair of old data points that is not an mst edge is the
+// heaviest edge on a cycle of old mst edges (cycle property), so it
+// stays out of the new mst. Prim's algorithm on the old mst edges and
+// the new pairs finds the new mst. The kept edges and the added ones
+// are merged, the merges before the first removed or added edge keep
+// their place in the dendrogram and only the rest is joined again.
+// Ties may be broken differently than by single_link_mst on all data
+// points, the heights are the same.
+// save and load keep the state between runs (the mst and the merges
+// of the dendrogram), the data points are not part of it.
+
+namespace clusterol{
+
+  template <typename height_type = double>
+  class incremental_single_link{
+  public:
+    typedef weighted_edge<size_t, height_type> edge_type;
+
+    incremental_single_link(): n(0) {}
+
+    template <typename random_access_iterator, typename dissimilarity>
+    void insert(random_access_iterator data, random_access_iterator data_end, dissimilarity d = dissimilarity());
+
+    size_t size() const{
+      // number of data points inserted
+      return n;
+    }
+
+    const std::vector<edge_type>& edges() const{
+      // the mst, in merge order
+      return mst;
+    }
+
+    const dendrogram<height_type>& get_dendrogram() const{
+      return dend;
+    }
+
+    dendrogram<height_type> get_dendrogram(const stop_criterion& stop) const;
+
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+  private:
+    static const size_t npos = size_t(-1);
+
+    template <typename random_access_iterator, typename dissimilarity>
+    void splice(random_access_iterator data, size_t n_total, dissimilarity d, std::vector<char>& kept, std::vector<edge_type>& added) const;
+
+    void rebuild(size_t n_old, size_t n_prefix);
+
+    size_t n;
+    std::vector<edge_type> mst;		// n - 1 edges, sorted stably by weight
+    dendrogram<height_type> dend;
+  };
+
+
+  template <typename height_type>
+  const size_t incremental_single_link<height_type>::npos;
+
+
+  template <typename height_type>
+  dendrogram<height_type> incremental_single_link<height_type>::get_dendrogram(const stop_criterion& stop) const{
+    // the dendrogram up to where stop says so, as
+    // dendrogram_from_sorted_merges would stop on the mst
+    dendrogram<height_type> result(dend);
+    size_t n_merge = 0;
+    while(n_merge != dend.linkage.size() && !stop(n - n_merge, dend.linkage[n_merge].height))
+      ++n_merge;
+    for(size_t i = n_merge; i != dend.linkage.size(); ++i){
+      result.height[n + i] = 0;
+      result.size[n + i] = 0;
+    }
+    result.linkage.resize(n_merge);
+    result.root = n_merge > 0 ? n + n_merge - 1 : 0;
+    return result;
+  }
+
+
+  template <typename height_type>
+  template <typename random_access_iterator, typename dissimilarity>
+  void incremental_single_link<height_type>::insert(random_access_iterator data, random_access_iterator data_end, dissimilarity d){
+    // The first size() data points are the ones inserted before, in
+    // the same order, the others are new.
+    using namespace std;
+    size_t n_total = data_end - data, n_old = n;
+    if(n_total < n_old)
+      throw invalid_argument("incremental_single_link: fewer data points than inserted before");
+    if(n_total == n_old)
+      return;
+
+    if(n_old < 2){
+      // nothing to keep
+      typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::undirectedS, boost::no_property,
+				    boost::property<boost::edge_weight_t, height_type> > mst_type;
+      mst_type tree;
+      minimum_spanning_tree(data, data_end, tree, get(boost::edge_weight, tree), d);
+      mst.clear();
+      typename boost::graph_traits<mst_type>::edge_iterator ei, ei_end;
+      for(boost::tie(ei, ei_end) = boost::edges(tree); ei != ei_end; ++ei){
+	edge_type e = {boost::source(*ei, tree), boost::target(*ei, tree), get(boost::edge_weight, tree, *ei)};
+	mst.push_back(e);
+      }
+      parallel_stable_sort(mst.begin(), mst.end(), merge_weight_less<height_type>);
+      n = n_total;
+      rebuild(n_old, 0);
+      return;
+    }
+
+    vector<char> kept(mst.size(), false);
+    vector<edge_type> added;
+    splice(data, n_total, d, kept, added);
+    stable_sort(added.begin(), added.end(), merge_weight_less<height_type>);
+
+    // Merge the kept edges and the added ones, the old ones first on
+    // ties. Up to the first removed or added edge, the order is the
+    // old one.
+    vector<edge_type> merged;
+    merged.reserve(n_total - 1);
+    size_t n_prefix = npos, j = 0;
+    for(size_t i = 0; i != mst.size(); ++i){
+      for(; j != added.size() && added[j].weight < mst[i].weight; ++j){
+	if(n_prefix == npos)
+	  n_prefix = merged.size();
+	merged.push_back(added[j]);
+      }
+      if(kept[i])
+	merged.push_back(mst[i]);
+      else if(n_prefix == npos)
+	n_prefix = merged.size();
+    }
+    if(n_prefix == npos)
+      n_prefix = merged.size();
+    merged.insert(merged.end(), added.begin() + j, added.end());
+
+    mst.swap(merged);
+    n = n_total;
+    rebuild(n_old, n_prefix);
+  }
+
+
+  template <typename height_type>
+  template <typename random_access_iterator, typename dissimilarity>
+  void incremental_single_link<height_type>::splice(random_access_iterator data, size_t n_total, dissimilarity d,
+						    std::vector<char>& kept, std::vector<edge_type>& added) const{
+    // Prim's algorithm from data point 0 on the old mst edges and all
+    // pairs with a new data point. Every such pair is computed once,
+    // when the first of the two joins the tree. A lazy heap orders the
+    // data points outside by their lightest edge to the tree (ties by
+    // data point), outdated entries are skipped. Old mst edges still
+    // used are marked in kept, the others are added.
+    using namespace std;
+    size_t n_old = n, n_new = n_total - n;
+
+    CLUSTEROL_PROFILE_SCOPE("incremental_single_link");
+    CLUSTEROL_PROFILE_COUNT("distance_calls", n_old * n_new + n_new * (n_new - 1) / 2);
+
+    // old mst edges by data point
+    vector<size_t> first_incident(n_old + 1, 0), incident(2 * mst.size());
+    for(size_t e = 0; e != mst.size(); ++e){
+      ++first_incident[mst[e].source + 1];
+      ++first_incident[mst[e].target + 1];
+    }
+    for(size_t v = 0; v != n_old; ++v)
+      first_incident[v + 1] += first_incident[v];
+    vector<size_t> next_incident(first_incident.begin(), first_incident.end() - 1);
+    for(size_t e = 0; e != mst.size(); ++e){
+      incident[next_incident[mst[e].source]++] = e;
+      incident[next_incident[mst[e].target]++] = e;
+    }
+
+    // old and new data points outside the tree, compacted by moving the
+    // last one into the gap, slot is the position of a data point
+    vector<size_t> outside_old(n_old), outside_new(n_new), slot(n_total);
+    for(size_t v = 0; v != n_total; ++v){
+      (v < n_old ? outside_old[v] : outside_new[v - n_old]) = v;
+      slot[v] = v < n_old ? v : v - n_old;
+    }
+
+    vector<height_type> key(n_total, numeric_limits<height_type>::infinity());
+    vector<size_t> parent(n_total, npos), parent_edge(n_total, npos);
+    vector<char> in_tree(n_total, false);
+    vector<height_type> w(max(n_old, n_new));	// dissimilarities to the data point just added
+
+    typedef pair<height_type, size_t> entry;
+    priority_queue<entry, vector<entry>, greater<entry> > heap;
+    key[0] = 0;
+    heap.push(entry(0, 0));
+    while(!heap.empty()){
+      size_t v = heap.top().second;
+      heap.pop();
+      if(in_tree[v])
+	continue;
+
+      in_tree[v] = true;
+      vector<size_t>& outside = v < n_old ? outside_old : outside_new;
+      outside[slot[v]] = outside.back();
+      slot[outside.back()] = slot[v];
+      outside.pop_back();
+      if(parent_edge[v] != npos)
+	kept[parent_edge[v]] = true;
+      else if(parent[v] != npos){
+	edge_type e = {v, parent[v], key[v]};
+	added.push_back(e);
+      }
+
+      if(v < n_old){
+	for(size_t i = first_incident[v]; i != first_incident[v + 1]; ++i){
+	  const edge_type& e = mst[incident[i]];
+	  size_t u = e.source == v ? e.target : e.source;
+	  if(!in_tree[u] && e.weight < key[u]){
+	    key[u] = e.weight;
+	    parent[u] = v;
+	    parent_edge[u] = incident[i];
+	    heap.push(entry(key[u], u));
+	  }
+	}
+      }
+
+      // pairs of v with the new data points outside, for a new v also
+      // with the old ones
+      for(int side = v < n_old ? 1 : 0; side != 2; ++side){
+	const vector<size_t>& candidate = side == 0 ? outside_old : outside_new;
+	size_t n_candidate = candidate.size();
+
+	CLUSTEROL_OMP(omp parallel for if(n_candidate > mst_parallel_cutoff) firstprivate(d))
+	for(size_t j = 0; j < n_candidate; ++j)
+	  w[j] = d(data[candidate[j]], data[v]);
+
+	for(size_t j = 0; j != n_candidate; ++j){
+	  size_t u = candidate[j];
+	  if(w[j] < key[u]){
+	    key[u] = w[j];
+	    parent[u] = v;
+	    parent_edge[u] = npos;
+	    heap.push(entry(key[u], u));
+	  }
+	}
+      }
+    }
+  }
+
+
+  template <typename height_type>
+  void incremental_single_link<height_type>::rebuild(size_t n_old, size_t n_prefix){
+    // dend from mst. The first n_prefix merges are those of the old
+    // dendrogram of n_old data points, their vertices are renumbered
+    // for the new data points. The union-find for the remaining merges
+    // starts from the top vertices after the prefix.
+    if(n == 0){
+      dend = dendrogram<height_type>();
+      return;
+    }
+    dendrogram<height_type> old(n);
+    std::swap(old, dend);
+    size_t shift = n - n_old;
+    for(size_t i = 0; i != n_prefix; ++i){
+      size_t left = old.linkage[i].left, right = old.linkage[i].right;
+      dend.join(left < n_old ? left : left + shift, right < n_old ? right : right + shift, old.linkage[i].height);
+    }
+
+    // top vertex of every vertex after the prefix, as in labels()
+    size_t n_vertex = n + n_prefix;
+    std::vector<size_t> top(n_vertex, npos);
+    for(size_t i = 0; i != n_prefix; ++i)
+      top[dend.linkage[i].left] = top[dend.linkage[i].right] = n + i;
+    for(size_t v = n_vertex; v-- > 0;)
+      top[v] = top[v] == npos ? v : top[top[v]];
+
+    union_find sets(n_vertex);
+    std::vector<size_t> rep_to_vertex(n_vertex);
+    for(size_t v = 0; v != n_vertex; ++v)
+      rep_to_vertex[v] = v;
+    for(size_t i = n_prefix; i != mst.size(); ++i){
+      size_t rep_s = sets.find(top[mst[i].source]);
+      size_t rep_t = sets.find(top[mst[i].target]);
+      size_t parent = dend.join(rep_to_vertex[rep_s], rep_to_vertex[rep_t], mst[i].weight);
+      rep_to_vertex[sets.link(rep_s, rep_t)] = parent;
+    }
+  }
+
+
+  template <typename height_type>
+  void incremental_single_link<height_type>::save(std::ostream& out) const{
+    // "clusterol-single-link <n> <bytes per height>\n", then the mst
+    // edges in merge order as uint64 source, uint64 target, the uint64
+    // left and right vertex of its merge in the dendrogram and the
+    // weight, in native byte order
+    out << "clusterol-single-link " << n << " " << sizeof(height_type) << "\n";
+    for(size_t i = 0; i != mst.size(); ++i){
+      uint64_t vertex[4] = {mst[i].source, mst[i].target, dend.linkage[i].left, dend.linkage[i].right};
+      out.write(reinterpret_cast<const char*>(vertex), sizeof(vertex));
+      out.write(reinterpret_cast<const char*>(&mst[i].weight), sizeof(height_type));
+    }
+    if(!out)
+      throw std::runtime_error("incremental_single_link: could not save the state");
+  }
+
+
+  template <typename height_type>
+  void incremental_single_link<height_type>::load(std::istream& in){
+    // a state written by save, the dendrogram is taken as saved after
+    // checking that every vertex is merged once, after it exists
+    std::string magic;
+    size_t n_in = 0, word_size = 0;
+    in >> magic >> n_in >> word_size;
+    if(!in || in.get() != '\n' || magic != "clusterol-single-link")
+      throw std::runtime_error("incremental_single_link: not a saved state");
+    if(word_size != sizeof(height_type))
+      throw std::runtime_error("incremental_single_link: the state was saved with another height type");
+
+    std::vector<edge_type> edge(n_in > 0 ? n_in - 1 : 0);
+    dendrogram<height_type> dend_in = n_in > 0 ? dendrogram<height_type>(n_in) : dendrogram<height_type>();
+    std::vector<char> merged(n_in > 0 ? 2 * n_in - 1 : 0, false);
+    for(size_t i = 0; i != edge.size(); ++i){
+      uint64_t vertex[4];
+      in.read(reinterpret_cast<char*>(vertex), sizeof(vertex));
+      in.read(reinterpret_cast<char*>(&edge[i].weight), sizeof(height_type));
+      if(!in || vertex[0] >= n_in || vertex[1] >= n_in)
+	throw std::runtime_error("incremental_single_link: truncated or corrupt state");
+      for(size_t k = 2; k != 4; ++k){
+	if(vertex[k] >= n_in + i || merged[vertex[k]])
+	  throw std::runtime_error("incremental_single_link: truncated or corrupt state");
+	merged[vertex[k]] = true;
+      }
+      edge[i].source = vertex[0];
+      edge[i].target = vertex[1];
+      dend_in.join(vertex[2], vertex[3], edge[i].weight);
+    }
+
+    mst.swap(edge);
+    std::swap(dend, dend_in);
+    n = n_in;
+  }
+
+}
+
+#endif /* _CLUSTEROL_INCREMENTAL_H_ */
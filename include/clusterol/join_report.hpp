@@ -9,9 +9,12 @@
 #include <boost/property_map.hpp>
 #endif
 #include <vector>
+#include <iterator>
+#include <cstddef>
 
 
-// Report joined pairs and heights in a simple vector.
+// Report joined pairs and heights in a simple vector, or one by one
+// with a join_report_iterator.
 
 namespace clusterol{
 
@@ -40,9 +43,9 @@ namespace clusterol{
     
     typename boost::graph_traits<tree_type>::vertex_iterator vi, vi_end;
     for(boost::tie(vi, vi_end) = vertices(tree); vi != vi_end; ++vi){
-      typename boost::graph_traits<tree_type>::out_edge_iterator oi, oi_end;
-      boost::tie(oi, oi_end) = boost::out_edges(*vi, tree);
-      if(std::distance(oi, oi_end)){
+      if(out_degree(*vi, tree)){
+	typename boost::graph_traits<tree_type>::out_edge_iterator oi, oi_end;
+	boost::tie(oi, oi_end) = boost::out_edges(*vi, tree);
 	// This is an inner vertex, write data to join_report
 	typename boost::graph_traits<tree_type>::vertex_descriptor v_left, v_right;
 	v_left = boost::target(*oi, tree);
@@ -56,6 +59,83 @@ namespace clusterol{
   }
 
 
+  template <typename dendrogram_type>
+  class join_report_iterator{
+    // The join report of a dendrogram entry by entry, straight from
+    // its linkage. Inner vertices are created in merge order, so the
+    // entries come sorted by vertex. The entry lives in the iterator
+    // and is valid until it moves on.
+  public:
+    typedef typename dendrogram_type::join_report_entry_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type* pointer;
+    typedef const value_type& reference;
+    typedef std::input_iterator_tag iterator_category;
+
+    join_report_iterator(const dendrogram_type& dend_, size_t i_)
+      : dend(&dend_), i(i_)
+    {}
+
+    reference operator*() const{
+      entry.vertex = dend->n_data_point + i;
+      entry.pair = std::make_pair(dend->linkage[i].left, dend->linkage[i].right);
+      entry.height = dend->linkage[i].height;
+      return entry;
+    }
+
+    pointer operator->() const{
+      return &**this;
+    }
+
+    join_report_iterator& operator++(){
+      ++i;
+      return *this;
+    }
+
+    join_report_iterator operator++(int){
+      join_report_iterator old = *this;
+      ++i;
+      return old;
+    }
+
+    bool operator==(const join_report_iterator& other) const{
+      return i == other.i;
+    }
+
+    bool operator!=(const join_report_iterator& other) const{
+      return i != other.i;
+    }
+
+  private:
+    const dendrogram_type* dend;
+    size_t i;
+    mutable value_type entry;
+  };
+
+
+  template <typename dendrogram_type>
+  join_report_iterator<dendrogram_type> join_report_begin(const dendrogram_type& dend){
+    return join_report_iterator<dendrogram_type>(dend, 0);
+  }
+
+  template <typename dendrogram_type>
+  join_report_iterator<dendrogram_type> join_report_end(const dendrogram_type& dend){
+    return join_report_iterator<dendrogram_type>(dend, dend.linkage.size());
+  }
+
+
+  template <typename dendrogram_type>
+  std::vector<typename dendrogram_type::join_report_entry_type>
+  get_join_report(const dendrogram_type& dend){
+    // get vector for N-1 inner vertices from the linkage of a
+    // dendrogram, sorted by vertex, in O(N) without a sort
+    std::vector<typename dendrogram_type::join_report_entry_type> join_report;
+    join_report.reserve(dend.linkage.size());
+    join_report.insert(join_report.end(), join_report_begin(dend), join_report_end(dend));
+    return join_report;
+  }
+
+
   template <typename vertex_descriptor>
   int vertex_descriptor_to_R(vertex_descriptor v, size_t n_data_point){
     // convert a numeric vertex_descriptor to R-style descriptor as in hclust$merge
@@ -0,0 +1,185 @@
+#ifndef _CLUSTEROL_KD_TREE_H_
+#define _CLUSTEROL_KD_TREE_H_
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+
+// A kd-tree over data points with begin() and end() (like the data
+// points for dissimilarity_be). The coordinates are copied into one
+// contiguous array in tree order, every node owns a range of it and
+// a bounding box. Nodes are split at the median of their widest
+// dimension until at most leaf_size points remain or all points of the
+// node are equal. Such a leaf may be large (duplicates), algorithms
+// should treat its points as one (node::all_equal).
+
+namespace clusterol{
+
+  template <typename coordinate_type = double>
+  class kd_tree{
+  public:
+    static const size_t npos = size_t(-1);
+
+    struct node{
+      size_t begin, end;	// points in tree order
+      size_t left, right;	// children, npos for leaves
+      bool all_equal;		// a leaf whose points have the same coordinates
+    };
+
+    template <typename random_access_iterator>
+    kd_tree(random_access_iterator data, random_access_iterator data_end, size_t leaf_size = 16);
+
+    size_t size() const{
+      return n;
+    }
+
+    size_t dim() const{
+      return d;
+    }
+
+    const coordinate_type* point(size_t k) const{
+      // k-th point in tree order
+      return &coord[k * d];
+    }
+
+    size_t index(size_t k) const{
+      // position of the k-th point in data
+      return perm[k];
+    }
+
+    size_t n_node() const{
+      // the root is node 0
+      return nodes.size();
+    }
+
+    const node& operator[](size_t i) const{
+      return nodes[i];
+    }
+
+    bool is_leaf(size_t i) const{
+      return nodes[i].left == npos;
+    }
+
+    coordinate_type box_distance2(size_t a, size_t b) const{
+      // squared minimum distance between the boxes of nodes a and b
+      const coordinate_type* lo_a = &box[2 * d * a];
+      const coordinate_type* hi_a = lo_a + d;
+      const coordinate_type* lo_b = &box[2 * d * b];
+      const coordinate_type* hi_b = lo_b + d;
+      coordinate_type result = 0;
+      for(size_t j = 0; j != d; ++j){
+	coordinate_type gap = std::max(lo_b[j] - hi_a[j], lo_a[j] - hi_b[j]);
+	if(gap > 0)
+	  result += gap * gap;
+      }
+      return result;
+    }
+
+    coordinate_type point_box_distance2(const coordinate_type* x, size_t a) const{
+      // squared minimum distance between x and the box of node a
+      const coordinate_type* lo = &box[2 * d * a];
+      const coordinate_type* hi = lo + d;
+      coordinate_type result = 0;
+      for(size_t j = 0; j != d; ++j){
+	coordinate_type gap = std::max(lo[j] - x[j], x[j] - hi[j]);
+	if(gap > 0)
+	  result += gap * gap;
+      }
+      return result;
+    }
+
+  private:
+    struct coordinate_less{
+      coordinate_less(const std::vector<coordinate_type>& raw_, size_t d_, size_t j_): raw(raw_), d(d_), j(j_) {}
+      bool operator()(size_t a, size_t b) const{
+	return raw[a * d + j] < raw[b * d + j];
+      }
+      const std::vector<coordinate_type>& raw;
+      size_t d, j;
+    };
+
+    size_t build(const std::vector<coordinate_type>& raw, size_t begin, size_t end, size_t leaf_size);
+
+    size_t n, d;
+    std::vector<coordinate_type> coord;	// n x d, tree order
+    std::vector<size_t> perm;		// tree order -> data
+    std::vector<node> nodes;
+    std::vector<coordinate_type> box;	// lo[d], hi[d] per node
+  };
+
+
+  template <typename coordinate_type>
+  const size_t kd_tree<coordinate_type>::npos;
+
+
+  template <typename coordinate_type>
+  template <typename random_access_iterator>
+  kd_tree<coordinate_type>::kd_tree(random_access_iterator data, random_access_iterator data_end, size_t leaf_size)
+    : n(std::distance(data, data_end)),
+      d(n > 0 ? std::distance(data[0].begin(), data[0].end()) : 0),
+      perm(n)
+  {
+    std::vector<coordinate_type> raw(n * d);
+    for(size_t i = 0; i != n; ++i){
+      std::copy(data[i].begin(), data[i].end(), raw.begin() + i * d);
+      perm[i] = i;
+    }
+
+    if(n > 0){
+      nodes.reserve(2 * (n / std::max<size_t>(leaf_size, 1)) + 1);
+      build(raw, 0, n, std::max<size_t>(leaf_size, 1));
+    }
+
+    coord.resize(n * d);
+    for(size_t k = 0; k != n; ++k)
+      std::copy(raw.begin() + perm[k] * d, raw.begin() + (perm[k] + 1) * d, coord.begin() + k * d);
+  }
+
+
+  template <typename coordinate_type>
+  size_t kd_tree<coordinate_type>::build(const std::vector<coordinate_type>& raw, size_t begin, size_t end, size_t leaf_size){
+    // build the subtree of points [begin, end), return its node
+    size_t id = nodes.size();
+    node nd = {begin, end, npos, npos, false};
+    nodes.push_back(nd);
+
+    // bounding box
+    box.resize(box.size() + 2 * d);
+    coordinate_type* lo = &box[2 * d * id];
+    coordinate_type* hi = lo + d;
+    std::copy(raw.begin() + perm[begin] * d, raw.begin() + (perm[begin] + 1) * d, lo);
+    std::copy(lo, lo + d, hi);
+    for(size_t k = begin + 1; k < end; ++k){
+      for(size_t j = 0; j != d; ++j){
+	coordinate_type x = raw[perm[k] * d + j];
+	lo[j] = std::min(lo[j], x);
+	hi[j] = std::max(hi[j], x);
+      }
+    }
+
+    size_t split = 0;
+    for(size_t j = 1; j < d; ++j)
+      if(hi[j] - lo[j] > hi[split] - lo[split])
+	split = j;
+    if(d == 0 || !(hi[split] > lo[split])){
+      nodes[id].all_equal = true;
+      return id;
+    }
+
+    if(end - begin <= leaf_size)
+      return id;
+
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end, coordinate_less(raw, d, split));
+
+    size_t left = build(raw, begin, mid, leaf_size);
+    size_t right = build(raw, mid, end, leaf_size);
+    nodes[id].left = left;
+    nodes[id].right = right;
+    return id;
+  }
+
+}
+
+#endif /* _CLUSTEROL_KD_TREE_H_ */
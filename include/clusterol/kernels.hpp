@@ -0,0 +1,502 @@
+#ifndef _CLUSTEROL_KERNELS_H_
+#define _CLUSTEROL_KERNELS_H_
+
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <stdint.h>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Distance kernels on contiguous arrays.
+// The instruction set is chosen at compile time: AVX-512 or AVX2 if
+// the compiler targets them (e.g. -march=native, see CLUSTEROL_NATIVE
+// in CMakeLists.txt), otherwise a scalar loop with independent
+// accumulators. The summation order differs from a plain loop, so
+// results may differ in the last bits.
+// Every metric is a struct with
+//   run<accumulator>(a, b, dim)
+//                      vectorized, a and b are float or double arrays,
+//                      summed up in accumulator (float arrays may be
+//                      widened to double); with dim a fixed_dimension
+//                      the loops are unrolled completely at compile time
+//   scalar(a, b, dim)  any random access iterators
+//   finish(x)          turns the result into the distance
+// by_dimension calls run with a fixed_dimension for common small
+// dimensions.
+
+namespace clusterol{
+  namespace kernel{
+
+#if defined(__AVX2__)
+    inline double horizontal_sum(__m256d v){
+      __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+      return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    inline float horizontal_sum(__m256 v){
+      __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+      s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+
+    inline double horizontal_max(__m256d v){
+      __m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+      return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+    }
+
+    inline float horizontal_max(__m256 v){
+      __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+      m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+      return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+    }
+#endif
+
+#if defined(__AVX512F__)
+    // GCC 12 implements _mm512_max_*, _mm512_cvtps_pd and the extracts
+    // behind _mm512_reduce_* with an uninitialized pass-through operand
+    // and warns about it (-Wmaybe-uninitialized) wherever they are
+    // inlined. The zero-masked forms with all lanes selected compile to
+    // the same instructions without it.
+    template <int k>
+    inline __m256d half(__m512d v){
+      return _mm512_maskz_extractf64x4_pd(0xF, v, k);
+    }
+
+    template <int k>
+    inline __m256 half(__m512 v){
+      return _mm256_castpd_ps(half<k>(_mm512_castps_pd(v)));
+    }
+
+    inline double horizontal_sum(__m512d v){
+      // the order of _mm512_reduce_add_pd
+      return horizontal_sum(_mm256_add_pd(half<0>(v), half<1>(v)));
+    }
+
+    inline float horizontal_sum(__m512 v){
+      return horizontal_sum(_mm256_add_ps(half<0>(v), half<1>(v)));
+    }
+
+    inline double horizontal_max(__m512d v){
+      return horizontal_max(_mm256_max_pd(half<0>(v), half<1>(v)));
+    }
+
+    inline float horizontal_max(__m512 v){
+      return horizontal_max(_mm256_max_ps(half<0>(v), half<1>(v)));
+    }
+#endif
+
+
+    // simd<T>: the lanes of one vector register of T
+#if defined(__AVX512F__)
+    template <typename T> struct simd;
+
+    template <> struct simd<double>{
+      typedef __m512d type;
+      static const size_t width = 8;
+      static type zero(){ return _mm512_setzero_pd(); }
+      static type load(const double* p){ return _mm512_loadu_pd(p); }
+      static type load(const float* p){ return _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(p)); }
+      static type add(type a, type b){ return _mm512_add_pd(a, b); }
+      static type sub(type a, type b){ return _mm512_sub_pd(a, b); }
+      static type mul_add(type a, type b, type c){ return _mm512_fmadd_pd(a, b, c); }
+      static type abs(type a){ return _mm512_abs_pd(a); }
+      static type max(type a, type b){ return _mm512_maskz_max_pd(0xFF, a, b); }
+      static double sum(type a){ return horizontal_sum(a); }
+      static double max_of(type a){ return horizontal_max(a); }
+    };
+
+    template <> struct simd<float>{
+      typedef __m512 type;
+      static const size_t width = 16;
+      static type zero(){ return _mm512_setzero_ps(); }
+      static type load(const float* p){ return _mm512_loadu_ps(p); }
+      static type add(type a, type b){ return _mm512_add_ps(a, b); }
+      static type sub(type a, type b){ return _mm512_sub_ps(a, b); }
+      static type mul_add(type a, type b, type c){ return _mm512_fmadd_ps(a, b, c); }
+      static type abs(type a){ return _mm512_abs_ps(a); }
+      static type max(type a, type b){ return _mm512_maskz_max_ps(0xFFFF, a, b); }
+      static float sum(type a){ return horizontal_sum(a); }
+      static float max_of(type a){ return horizontal_max(a); }
+    };
+#elif defined(__AVX2__)
+    template <typename T> struct simd;
+
+    template <> struct simd<double>{
+      typedef __m256d type;
+      static const size_t width = 4;
+      static type zero(){ return _mm256_setzero_pd(); }
+      static type load(const double* p){ return _mm256_loadu_pd(p); }
+      static type load(const float* p){ return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+      static type add(type a, type b){ return _mm256_add_pd(a, b); }
+      static type sub(type a, type b){ return _mm256_sub_pd(a, b); }
+      static type mul_add(type a, type b, type c){ return _mm256_add_pd(c, _mm256_mul_pd(a, b)); }
+      static type abs(type a){ return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+      static type max(type a, type b){ return _mm256_max_pd(a, b); }
+      static double sum(type a){ return horizontal_sum(a); }
+      static double max_of(type a){ return horizontal_max(a); }
+    };
+
+    template <> struct simd<float>{
+      typedef __m256 type;
+      static const size_t width = 8;
+      static type zero(){ return _mm256_setzero_ps(); }
+      static type load(const float* p){ return _mm256_loadu_ps(p); }
+      static type add(type a, type b){ return _mm256_add_ps(a, b); }
+      static type sub(type a, type b){ return _mm256_sub_ps(a, b); }
+      static type mul_add(type a, type b, type c){ return _mm256_add_ps(c, _mm256_mul_ps(a, b)); }
+      static type abs(type a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+      static type max(type a, type b){ return _mm256_max_ps(a, b); }
+      static float sum(type a){ return horizontal_sum(a); }
+      static float max_of(type a){ return horizontal_max(a); }
+    };
+#else
+    template <typename T> struct simd{
+      // four independent scalar accumulators
+      struct type{
+	T v[4];
+      };
+      static const size_t width = 4;
+      static type zero(){
+	type r = {{0, 0, 0, 0}};
+	return r;
+      }
+      template <typename U>
+      static type load(const U* p){
+	type r = {{T(p[0]), T(p[1]), T(p[2]), T(p[3])}};
+	return r;
+      }
+      static type add(type a, type b){
+	for(size_t i = 0; i != 4; ++i)
+	  a.v[i] += b.v[i];
+	return a;
+      }
+      static type sub(type a, type b){
+	for(size_t i = 0; i != 4; ++i)
+	  a.v[i] -= b.v[i];
+	return a;
+      }
+      static type mul_add(type a, type b, type c){
+	for(size_t i = 0; i != 4; ++i)
+	  c.v[i] += a.v[i] * b.v[i];
+	return c;
+      }
+      static type abs(type a){
+	for(size_t i = 0; i != 4; ++i)
+	  a.v[i] = std::abs(a.v[i]);
+	return a;
+      }
+      static type max(type a, type b){
+	for(size_t i = 0; i != 4; ++i)
+	  a.v[i] = std::max(a.v[i], b.v[i]);
+	return a;
+      }
+      static T sum(type a){
+	return (a.v[0] + a.v[1]) + (a.v[2] + a.v[3]);
+      }
+      static T max_of(type a){
+	return std::max(std::max(a.v[0], a.v[1]), std::max(a.v[2], a.v[3]));
+      }
+    };
+#endif
+
+
+    template <typename T, typename U, typename dimension>
+    inline T squared_euclidean(const U* a, const U* b, dimension dim){
+      // U values summed up in T, as the other kernels
+      typedef simd<T> S;
+      const size_t n_vector = dim - dim % S::width;
+      size_t i = 0;
+      typename S::type acc = S::zero();
+      for(; i != n_vector; i += S::width){
+	typename S::type diff = S::sub(S::load(a + i), S::load(b + i));
+	acc = S::mul_add(diff, diff, acc);
+      }
+      T result = n_vector == 0 ? T(0) : S::sum(acc);
+      for(; i != dim; ++i){
+	T diff = T(a[i]) - T(b[i]);
+	result += diff * diff;
+      }
+      return result;
+    }
+
+
+    template <typename T, typename U, typename dimension>
+    inline T manhattan(const U* a, const U* b, dimension dim){
+      typedef simd<T> S;
+      const size_t n_vector = dim - dim % S::width;
+      size_t i = 0;
+      typename S::type acc = S::zero();
+      for(; i != n_vector; i += S::width)
+	acc = S::add(acc, S::abs(S::sub(S::load(a + i), S::load(b + i))));
+      T result = n_vector == 0 ? T(0) : S::sum(acc);
+      for(; i != dim; ++i)
+	result += std::abs(T(a[i]) - T(b[i]));
+      return result;
+    }
+
+
+    template <typename T, typename U, typename dimension>
+    inline T chebyshev(const U* a, const U* b, dimension dim){
+      typedef simd<T> S;
+      const size_t n_vector = dim - dim % S::width;
+      size_t i = 0;
+      typename S::type acc = S::zero();
+      for(; i != n_vector; i += S::width)
+	acc = S::max(acc, S::abs(S::sub(S::load(a + i), S::load(b + i))));
+      T result = n_vector == 0 ? T(0) : S::max_of(acc);
+      for(; i != dim; ++i)
+	result = std::max(result, std::abs(T(a[i]) - T(b[i])));
+      return result;
+    }
+
+
+    template <typename T>
+    inline T cosine_from_products(T ab, T aa, T bb){
+      // 1 - cos(a, b) in [0, 2], 0 for two zero vectors, 1 for one
+      if(aa == 0 || bb == 0)
+	return aa == bb ? 0 : 1;
+      return std::min(T(2), std::max(T(0), T(1) - ab / std::sqrt(aa * bb)));
+    }
+
+    template <typename T, typename U, typename dimension>
+    inline T cosine(const U* a, const U* b, dimension dim){
+      typedef simd<T> S;
+      const size_t n_vector = dim - dim % S::width;
+      size_t i = 0;
+      typename S::type ab = S::zero(), aa = S::zero(), bb = S::zero();
+      for(; i != n_vector; i += S::width){
+	typename S::type x = S::load(a + i), y = S::load(b + i);
+	ab = S::mul_add(x, y, ab);
+	aa = S::mul_add(x, x, aa);
+	bb = S::mul_add(y, y, bb);
+      }
+      T sum_ab = 0, sum_aa = 0, sum_bb = 0;
+      if(n_vector != 0){
+	sum_ab = S::sum(ab);
+	sum_aa = S::sum(aa);
+	sum_bb = S::sum(bb);
+      }
+      for(; i != dim; ++i){
+	T x = a[i], y = b[i];
+	sum_ab += x * y;
+	sum_aa += x * x;
+	sum_bb += y * y;
+      }
+      return cosine_from_products(sum_ab, sum_aa, sum_bb);
+    }
+
+
+    template <typename dimension>
+    inline uint64_t bit_hamming(const uint64_t* a, const uint64_t* b, dimension n_word){
+      // number of different bits in n_word words
+      size_t i = 0;
+      uint64_t result = 0;
+#if defined(__AVX512VPOPCNTDQ__)
+      const size_t n_vector = n_word - n_word % 8;
+      __m512i acc = _mm512_setzero_si512();
+      for(; i != n_vector; i += 8){
+	__m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+	acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+      }
+      if(n_vector != 0){
+	// not _mm512_reduce_add_epi64, see half
+	uint64_t lanes[8];
+	_mm512_storeu_si512(lanes, acc);
+	result = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+      }
+#else
+      const size_t n_vector = n_word - n_word % 4;
+      uint64_t r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+      for(; i != n_vector; i += 4){
+	r0 += __builtin_popcountll(a[i] ^ b[i]);
+	r1 += __builtin_popcountll(a[i + 1] ^ b[i + 1]);
+	r2 += __builtin_popcountll(a[i + 2] ^ b[i + 2]);
+	r3 += __builtin_popcountll(a[i + 3] ^ b[i + 3]);
+      }
+      result = (r0 + r1) + (r2 + r3);
+#endif
+      for(; i != n_word; ++i)
+	result += __builtin_popcountll(a[i] ^ b[i]);
+      return result;
+    }
+
+
+    /********************************************************************************/
+    // metrics
+
+    struct squared_euclidean_kernel{
+      template <typename accumulator, typename T, typename dimension>
+      static accumulator run(const T* a, const T* b, dimension dim){
+	return squared_euclidean<accumulator>(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	double result = 0;
+	for(size_t i = 0; i != dim; ++i){
+	  double diff = double(a[i]) - double(b[i]);
+	  result += diff * diff;
+	}
+	return result;
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    struct euclidean_kernel: squared_euclidean_kernel{
+      template <typename T>
+      static T finish(T x){
+	return std::sqrt(x);
+      }
+    };
+
+
+    struct manhattan_kernel{
+      template <typename accumulator, typename T, typename dimension>
+      static accumulator run(const T* a, const T* b, dimension dim){
+	return manhattan<accumulator>(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	double result = 0;
+	for(size_t i = 0; i != dim; ++i)
+	  result += std::abs(double(a[i]) - double(b[i]));
+	return result;
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    struct chebyshev_kernel{
+      template <typename accumulator, typename T, typename dimension>
+      static accumulator run(const T* a, const T* b, dimension dim){
+	return chebyshev<accumulator>(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	double result = 0;
+	for(size_t i = 0; i != dim; ++i)
+	  result = std::max(result, std::abs(double(a[i]) - double(b[i])));
+	return result;
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    struct cosine_kernel{
+      template <typename accumulator, typename T, typename dimension>
+      static accumulator run(const T* a, const T* b, dimension dim){
+	return cosine<accumulator>(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	double ab = 0, aa = 0, bb = 0;
+	for(size_t i = 0; i != dim; ++i){
+	  double x = a[i], y = b[i];
+	  ab += x * y;
+	  aa += x * x;
+	  bb += y * y;
+	}
+	return cosine_from_products(ab, aa, bb);
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    struct hamming_kernel{
+      // number of different values
+      template <typename accumulator, typename T, typename dimension>
+      static accumulator run(const T* a, const T* b, dimension dim){
+	return scalar(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	size_t result = 0;
+	for(size_t i = 0; i != dim; ++i)
+	  result += a[i] != b[i];
+	return result;
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    struct bit_hamming_kernel{
+      // number of different bits of packed 64 bit words, dim counts
+      // words
+      template <typename accumulator, typename dimension>
+      static uint64_t run(const uint64_t* a, const uint64_t* b, dimension dim){
+	return bit_hamming(a, b, dim);
+      }
+
+      template <typename iterator>
+      static double scalar(iterator a, iterator b, size_t dim){
+	uint64_t result = 0;
+	for(size_t i = 0; i != dim; ++i)
+	  result += __builtin_popcountll(uint64_t(a[i]) ^ uint64_t(b[i]));
+	return result;
+      }
+
+      template <typename T>
+      static T finish(T x){
+	return x;
+      }
+    };
+
+
+    template <size_t dim>
+    struct fixed_dimension: std::integral_constant<size_t, dim> {};
+
+    template <typename kernel_t, typename accumulator, typename T>
+    inline accumulator by_dimension(const T* a, const T* b, size_t dim){
+      // Common small dimensions get their own kernel with all loops
+      // unrolled. The switch is predicted perfectly, dim is the same
+      // for all data points.
+      switch(dim){
+      case 2:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, fixed_dimension<2>()));
+      case 3:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, fixed_dimension<3>()));
+      case 4:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, fixed_dimension<4>()));
+      case 8:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, fixed_dimension<8>()));
+      case 16:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, fixed_dimension<16>()));
+      default:
+	return kernel_t::finish(kernel_t::template run<accumulator>(a, b, dim));
+      }
+    }
+
+  }
+}
+
+#endif /* _CLUSTEROL_KERNELS_H_ */
@@ -18,7 +18,8 @@
 // available in clustering literature. Clusterol expects an object of
 // the form
 // height_type LW(size_t x, size_t a, size_t b, const clusterol::dissimilarity_matrix<height_type>& dis_mat)
-// where x, a and b are cluster ids for dis_mat.
+// where x, a and b are cluster ids for dis_mat. Any matrix with
+// operator()(id, id) and a value_type works, e.g. condensed_matrix.
 
 
 namespace clusterol{
@@ -34,17 +35,41 @@ namespace clusterol{
     lance_williams_generic(){}		// allow default construction
 
 
-    template <typename height_type>
-    height_type operator()(size_t x, size_t a, size_t b, const clusterol::dissimilarity_matrix<height_type>& dis_mat){
+    template <typename matrix_t>
+    typename matrix_t::value_type operator()(size_t x, size_t a, size_t b, const matrix_t& dis_mat){
       return alpha_i * dis_mat(x, a) + alpha_j * dis_mat(x, b) + beta * dis_mat(a, b) + gamma * std::abs(dis_mat(x, a) - dis_mat(x,b));
     }
   
   private:
     // is copying 4 values everytime lance_williams needs to be copied a good idea?
+    // (lance_williams_fixed has none)
     double alpha_i, alpha_j, beta, gamma;
   };
 
 
+  template <int alpha_i, int alpha_j, int beta, int gamma, int denominator = 4>
+  struct lance_williams_fixed{
+    // lance_williams_generic with compile-time coefficients
+    // alpha_i / denominator etc., terms with a zero coefficient are
+    // left out
+    template <typename matrix_t>
+    typename matrix_t::value_type operator()(size_t x, size_t a, size_t b, const matrix_t& dis_mat){
+      typename matrix_t::value_type d_xa = dis_mat(x, a), d_xb = dis_mat(x, b);
+      typename matrix_t::value_type result = double(alpha_i) / denominator * d_xa + double(alpha_j) / denominator * d_xb;
+      if(beta != 0)
+	result += double(beta) / denominator * dis_mat(a, b);
+      if(gamma != 0)
+	result += double(gamma) / denominator * std::abs(d_xa - d_xb);
+      return result;
+    }
+  };
+
+  typedef lance_williams_fixed<2, 2, 0, -2> lance_williams_single_link;
+  typedef lance_williams_fixed<2, 2, 0, 2> lance_williams_complete_link;
+  typedef lance_williams_fixed<2, 2, 0, 0> lance_williams_weighted_group_average;
+  typedef lance_williams_fixed<2, 2, -1, 0> lance_williams_median;
+
+
   // change these to objects, which store n_member-maps permanently for more uniform cluster-algorithms
   template <typename height_type = double>
   struct lance_williams_ward{
@@ -53,7 +78,8 @@ namespace clusterol{
       : size(dend.size.begin())
     {}
     
-    height_type operator()(size_t x, size_t a, size_t b, const clusterol::dissimilarity_matrix<height_type>& dis_mat){
+    template <typename matrix_t>
+    height_type operator()(size_t x, size_t a, size_t b, const matrix_t& dis_mat){
       height_type member_sum = size[x] + size[a] + size[b];
       height_type alpha_i = (size[a] + size[x]) / member_sum;
       height_type alpha_j = (size[b] + size[x]) / member_sum;
@@ -74,7 +100,8 @@ namespace clusterol{
       : size(dend.size.begin())
     {}
     
-    height_type operator()(size_t x, size_t a, size_t b, const clusterol::dissimilarity_matrix<height_type>& dis_mat){
+    template <typename matrix_t>
+    height_type operator()(size_t x, size_t a, size_t b, const matrix_t& dis_mat){
       size_t member_sum = size[a] + size[b];
       height_type alpha_i = height_type(size[a]) / member_sum;
       height_type alpha_j = height_type(size[b]) / member_sum;
@@ -93,7 +120,8 @@ namespace clusterol{
       : size(dend.size.begin())
     {}
     
-    height_type operator()(size_t x, size_t a, size_t b, const clusterol::dissimilarity_matrix<height_type>& dis_mat){
+    template <typename matrix_t>
+    height_type operator()(size_t x, size_t a, size_t b, const matrix_t& dis_mat){
       size_t member_sum = size[a] + size[b];
       height_type alpha_i = (height_type) (size[a]) / member_sum;
       height_type alpha_j = (height_type) (size[b]) / member_sum;
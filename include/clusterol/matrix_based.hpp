@@ -4,6 +4,7 @@
 #include "dendrogram.hpp"
 #include "lance_williams.hpp"
 #include "dissimilarity_matrix.hpp"
+#include "profile.hpp"
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/version.hpp>
@@ -19,41 +20,53 @@
 
 namespace clusterol{
 
-  template <typename height_type, typename lance_williams>
-  void join(dissimilarity_matrix<height_type>& dis_mat, dendrogram<height_type>& dend, lance_williams lw){
-    // find minimum pair and join
-
-    std::pair<size_t, size_t> min_pair = dis_mat.min_pair();
+  template <typename matrix_t, typename height_type, typename lance_williams>
+  void join(matrix_t& dis_mat, dendrogram<height_type>& dend, lance_williams lw, std::pair<size_t, size_t> min_pair){
+    // join min_pair, the closest pair of dis_mat
+    CLUSTEROL_PROFILE_SCOPE("join");
+    CLUSTEROL_PROFILE_COUNT("lance_williams_evaluations", dis_mat.valid() - 2);
 
     // insert into dendrogram
-    typename dendrogram<height_type>::vertex_descriptor parent = add_vertex(dend.tree);
-    add_edge(parent, min_pair.first, dend.tree);
-    add_edge(parent, min_pair.second, dend.tree);
-    dend.height[parent] = dis_mat(min_pair.first, min_pair.second);
-    dend.size[parent] = dend.size[min_pair.first] + dend.size[min_pair.second];
-    dend.root = parent; 
+    typename dendrogram<height_type>::vertex_descriptor parent = dend.join(min_pair.first, min_pair.second, dis_mat(min_pair.first, min_pair.second));
     
-    // update dis_mat(min_pair.first, *)
-    for(typename dissimilarity_matrix<height_type>::id_iterator i = dis_mat.id_begin(); i != dis_mat.id_end(); ++i){
-      if(*i != min_pair.first && *i != min_pair.second){
-	height_type new_val = lw(*i, min_pair.first, min_pair.second, dis_mat);
-	dis_mat.update(min_pair.first, *i, new_val);
-      }
-    }
+    // update dis_mat(min_pair.first, *), in parallel for many rows
+    const matrix_t& dis_mat_const = dis_mat;
+    size_t a = min_pair.first, b = min_pair.second;
+    dis_mat.update_row(a, b, [a, b, &lw, &dis_mat_const](size_t x){
+	return height_type(lw(x, a, b, dis_mat_const));
+      });
 
     dis_mat.erase(min_pair.second);
     dis_mat.move(min_pair.first, parent);
   }
 
+  template <typename matrix_t, typename height_type, typename lance_williams>
+  void join(matrix_t& dis_mat, dendrogram<height_type>& dend, lance_williams lw){
+    // find minimum pair and join
+    join(dis_mat, dend, lw, dis_mat.min_pair());
+  }
+
+  template <typename height_type, typename matrix_t, typename lance_williams>
+  void matrix_cluster(dendrogram<height_type>& dend, matrix_t& dis_mat, lance_williams lw, const stop_criterion& stop = stop_criterion()){
+    // Cluster all rows of a dissimilarity_matrix, e.g. one with a
+    // file_matrix storage that doesn't fit into memory, until stop
+    // says so.
+    while(dis_mat.valid() > 1){
+      std::pair<size_t, size_t> min_pair = dis_mat.min_pair();
+      if(stop(dis_mat.valid(), dis_mat(min_pair.first, min_pair.second)))
+	break;
+      join(dis_mat, dend, lw, min_pair);
+    }
+  }
+
+
   template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
-  void matrix_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d, lance_williams lw){
+  void matrix_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d, lance_williams lw,
+		      const stop_criterion& stop = stop_criterion()){
     // Cluster with a dissimilarity_matrix. If lance_williams needs to
     // access property maps of dend, dend can not be generated here.
     dissimilarity_matrix<height_type> dis_mat(data, data_end, d);
-
-    while(dis_mat.valid() > 1)
-      join(dis_mat, dend, lw);
-
+    matrix_cluster(dend, dis_mat, lw, stop);
   }
 
   
@@ -2,10 +2,11 @@
 #define _CLUSTEROL_MINIMUM_SPANNING_TREE_H_
 
 #include "dendrogram.hpp"
+#include "parallel.hpp"
+#include "union_find.hpp"
+#include "profile.hpp"
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graph_traits.hpp>
-#include <boost/graph/depth_first_search.hpp>
-#include <boost/pending/disjoint_sets.hpp>
 // shut up warning on new boost
 #include <boost/version.hpp>
 #if BOOST_VERSION >= 104100
@@ -14,8 +15,8 @@
 #include <boost/property_map.hpp>
 #endif
 #include <vector>
-#include <list>
 #include <limits>
+#include <utility>
 
 
 // Implementation of MST and related single-link algorithm
@@ -29,52 +30,153 @@ namespace clusterol{
   };
 
   
+  // below this many candidates Prim's inner loop runs sequentially
+  const size_t mst_parallel_cutoff = 2048;
+
   template <typename random_access_data, typename graph, typename property_map, typename dissimilarity>
   void minimum_spanning_tree(const random_access_data data, const random_access_data data_end, graph& mst, property_map weight, dissimilarity d = dissimilarity()){
     // Prim's algorithm, O(N^2)
+    // The candidate edges connecting vertices not in the tree to the
+    // tree are kept as a structure of arrays, compacted by moving the
+    // last candidate into the gap of the one added to the tree.
     using namespace std; using namespace boost;
-  
+
     typedef typename graph_traits<graph>::edge_descriptor edge;
     typedef typename graph_traits<graph>::vertex_descriptor vertex;
     typedef typename property_traits<property_map>::value_type weight_type;
-    typedef weighted_edge<vertex, weight_type> w_edge;
-    typedef typename list<w_edge>::iterator list_it;
 
     size_t N = data_end - data;
 
     // add vertices 0 .. N-1 to the mst, start at v_new = 0
     mst = graph(N);
     vertex v_new = 0;
-  
-    // list of candidate edges connecting vertices not in the tree to vertices in the tree
-    list<w_edge> c_edge;
-    for(size_t i = 1; i < N; ++i)
-      c_edge.push_back((w_edge) {i, 0, numeric_limits<weight_type>::max()});
+    if(N < 2)
+      return;
+
+    CLUSTEROL_PROFILE_SCOPE("minimum_spanning_tree");
+    CLUSTEROL_PROFILE_COUNT("distance_calls", N * (N - 1) / 2);
+    CLUSTEROL_PROFILE_COUNT("allocated_bytes.minimum_spanning_tree", (N - 1) * (2 * sizeof(vertex) + sizeof(weight_type)));
+
+    // candidate k: source[k] not in tree, target[k] in tree
+    vector<vertex> c_source(N - 1), c_target(N - 1, 0);
+    vector<weight_type> c_weight(N - 1, numeric_limits<weight_type>::max());
+    for(size_t k = 0; k != N - 1; ++k)
+      c_source[k] = k + 1;
+
+    // best candidate of each thread
+    vector<size_t> thread_best(num_threads());
+
+    for(size_t n_candidate = N - 1; n_candidate > 0; --n_candidate){
+      size_t best = 0;
+
+      CLUSTEROL_OMP(omp parallel if(n_candidate > mst_parallel_cutoff) firstprivate(d))
+      {
+	// update candidate edges with v_new, find the best one.
+	// Ties go to the smaller vertex, independent of the thread count.
+	size_t my_best = n_candidate;
+	CLUSTEROL_OMP(omp for nowait)
+	for(size_t k = 0; k < n_candidate; ++k){
+	  weight_type w = d(data[c_source[k]], data[v_new]);
+	  if(c_weight[k] > w){
+	    c_weight[k] = w;
+	    c_target[k] = v_new;
+	  }
+	  if(my_best == n_candidate || c_weight[k] < c_weight[my_best]
+	     || (c_weight[k] == c_weight[my_best] && c_source[k] < c_source[my_best]))
+	    my_best = k;
+	}
+	thread_best[thread_num()] = my_best;
+
+	CLUSTEROL_OMP(omp barrier)
+	CLUSTEROL_OMP(omp single)
+	{
+	  size_t n_thread = num_threads_in_region();
+	  best = thread_best[0];
+	  for(size_t t = 1; t < n_thread; ++t){
+	    size_t k = thread_best[t];
+	    if(k == n_candidate)
+	      continue;
+	    if(best == n_candidate || c_weight[k] < c_weight[best]
+	       || (c_weight[k] == c_weight[best] && c_source[k] < c_source[best]))
+	      best = k;
+	  }
+	}
+      }
 
-    while(! c_edge.empty()){
-      list_it best_edge = c_edge.begin();
+      // add best to tree
+      v_new = c_source[best];
+      edge e_new = add_edge(c_source[best], c_target[best], mst).first;
+      weight[e_new] = c_weight[best];
+
+      // delete from candidates
+      size_t last = n_candidate - 1;
+      c_source[best] = c_source[last];
+      c_target[best] = c_target[last];
+      c_weight[best] = c_weight[last];
+    }
+  }
 
-      for(list_it i = c_edge.begin(); i != c_edge.end(); ++i){
-	weight_type w = d(data[i->source], data[v_new]);
 
-	// update candidate edges
-	if(i->weight > w){
-	  i->weight = w;
-	  i->target = v_new;
-	}
+  namespace{
+    template <typename weight_type>
+    bool merge_weight_less(const weighted_edge<size_t, weight_type>& a, const weighted_edge<size_t, weight_type>& b){
+      return a.weight < b.weight;
+    }
+
 
-	// update best edge
-	if(best_edge->weight > i->weight)
-	  best_edge = i;
+    template <typename property_map_weight>
+    struct mst_edge_less{
+      mst_edge_less(property_map_weight weight_): weight(weight_) {}
+      template <typename edge>
+      bool operator()(const edge& a, const edge& b) const{
+	return weight[a] < weight[b];
       }
+      property_map_weight weight;
+    };
 
-      // add best to tree
-      v_new = best_edge->source;
-      edge e_new = add_edge(best_edge->source, best_edge->target, mst).first;
-      weight[e_new] = best_edge->weight;
 
-      // delete from candidate list
-      c_edge.erase(best_edge);
+    struct tree_edges{
+      // Takes the joins of dendrogram_from_sorted_merges in place of a
+      // dendrogram and keeps only the edges from parents to children.
+      tree_edges(size_t n_data_point_): n_data_point(n_data_point_), n_merge(0) {
+	edge.reserve(n_data_point > 0 ? 2 * (n_data_point - 1) : 0);
+      }
+
+      template <typename height_type>
+      size_t join(size_t a, size_t b, height_type){
+	size_t parent = n_data_point + n_merge++;
+	edge.push_back(std::make_pair(parent, a));
+	edge.push_back(std::make_pair(parent, b));
+	return parent;
+      }
+
+      size_t n_data_point, n_merge;
+      std::vector< std::pair<size_t, size_t> > edge;
+    };
+
+
+    template <typename dendrogram_t, typename height_type>
+    void dendrogram_from_sorted_merges(dendrogram_t& dend, const std::vector< weighted_edge<size_t, height_type> >& merge,
+				       const stop_criterion& stop = stop_criterion()){
+      // One pass over merges sorted by weight, the i-th merge becomes
+      // the i-th join of dend (a dendrogram or tree_edges), until stop
+      // says so.
+      size_t n = dend.n_data_point;
+      union_find sets(n);
+
+      // representative element -> vertex in dend
+      std::vector<size_t> rep_to_vertex(n);
+      for(size_t i = 0; i != n; ++i)
+	rep_to_vertex[i] = i;
+
+      for(size_t i = 0; i != merge.size(); ++i){
+	if(stop(n - i, merge[i].weight))
+	  break;
+	size_t rep_s = sets.find(merge[i].source);
+	size_t rep_t = sets.find(merge[i].target);
+	size_t parent = dend.join(rep_to_vertex[rep_s], rep_to_vertex[rep_t], merge[i].weight);
+	rep_to_vertex[sets.link(rep_s, rep_t)] = parent;
+      }
     }
   }
 
@@ -83,123 +185,85 @@ namespace clusterol{
   void get_tree_from_mst(graph_tree& T, property_map_h h, propery_map_edge corresponding_edge, const graph_mst& mst, const property_map_weight weight){
     // get the corresponding clustering tree from a mst and its weights.
     // corresponding_edge will contain the correspondig mst edges to the heights in h.
-    // DO NOT CHANGE! This is used by Linf!  
+    // Linf calls this, keep the interface.
 
     using namespace std; using namespace boost;
   
     typedef typename property_traits<property_map_weight>::value_type weight_type;
     typedef typename graph_traits<graph_mst>::edge_descriptor mst_edge;
-    typedef typename graph_traits<graph_mst>::vertex_descriptor mst_vertex;
-    typedef typename graph_traits<graph_tree>::vertex_descriptor tree_vertex;
 
-    // sorted weights
-    multimap<weight_type, mst_edge> weight_edge_map;
-    // insert into map
+    // mst edges sorted by weight, equal weights keep their order
+    vector<mst_edge> sorted_edge;
+    sorted_edge.reserve(num_edges(mst));
     typename graph_traits<graph_mst>::edge_iterator ei, ei_end;
     for(tie(ei, ei_end) = edges(mst); ei != ei_end; ++ei)
-      weight_edge_map.insert(make_pair(weight[*ei], *ei));
+      sorted_edge.push_back(*ei);
+    parallel_stable_sort(sorted_edge.begin(), sorted_edge.end(), mst_edge_less<property_map_weight>(weight));
 
-    // init T, h, mst_edge
-    T = graph_tree(num_vertices(mst));
-    typename graph_traits<graph_tree>::vertex_iterator vi, vi_end;
-    for(tie(vi, vi_end) = vertices(T); vi != vi_end; ++vi){
-      h[*vi] = 0;
+    vector< weighted_edge<size_t, weight_type> > merge(sorted_edge.size());
+    for(size_t i = 0; i != sorted_edge.size(); ++i){
+      weighted_edge<size_t, weight_type> m = {source(sorted_edge[i], mst), target(sorted_edge[i], mst), weight[sorted_edge[i]]};
+      merge[i] = m;
     }
 
-    // disjoint sets, aka union find
-    // init: put every data point into its own set
-    disjoint_sets_with_storage<> dis_sets(num_vertices(mst));
-    for(size_t i = 0; i != num_vertices(mst); ++i)
-      dis_sets.make_set(i);
-
-    // representative element -> vertex in T
-    vector<tree_vertex> rep_to_vertex(num_vertices(mst));
-    for(size_t i = 0; i != rep_to_vertex.size(); ++i)
-      rep_to_vertex[i] = i;
-  
     // cluster
-    for(typename multimap<weight_type, mst_edge>::const_iterator i = weight_edge_map.begin(); i != weight_edge_map.end(); ++i){
-      tree_vertex parent = add_vertex(T);
-      h[parent] = i->first;
-      corresponding_edge[parent] = i->second;
-
-      size_t s = source(i->second, mst);
-      size_t t = target(i->second, mst);
-
-      // find representatives of sets containing s and t
-      size_t rep_s = dis_sets.find_set(s);
-      size_t rep_t = dis_sets.find_set(t);
-
-      // get tree vertices for rep_s and rep_t
-      tree_vertex child_s = rep_to_vertex[rep_s];
-      tree_vertex childissimilarity = rep_to_vertex[rep_t];
-
-      // connect parent to children
-      add_edge(parent, child_s, T);
-      add_edge(parent, childissimilarity, T);
-        
-      // set union
-      dis_sets.link(rep_s, rep_t);
-
-      // update rep_to_vertex
-      rep_to_vertex[dis_sets.find_set(rep_s)] = parent;
-    
+    size_t n = num_vertices(mst);
+    tree_edges tree(n);
+    dendrogram_from_sorted_merges(tree, merge);
+
+    for(size_t i = 0; i != n; ++i)
+      h[i] = 0;
+    for(size_t i = 0; i != merge.size(); ++i){
+      h[n + i] = merge[i].weight;
+      corresponding_edge[n + i] = sorted_edge[i];
     }
+    // built in place, copying a boost graph (also in its swap) is slow
+    T.clear();
+    for(size_t i = 0; i != n + merge.size(); ++i)
+      add_vertex(T);
+    for(size_t i = 0; i != tree.edge.size(); ++i)
+      add_edge(tree.edge[i].first, tree.edge[i].second, T);
   }
 
 
-  namespace{
-    // since single_link_mst does not write n_member, code from
-    // tree_util.hpp is included here. n_member has been renamed to
-    // size in dendrogram<>, but write_n_member and the
-    // n_member_writer are copied and pasted without renaming.
-    
-    template <typename property_map>
-      struct n_member_writer: public boost::base_visitor< n_member_writer<property_map> >{
-      // write number of members (i.e. number of leaves under a vertex) to a property map.
-      // use with depth-first search, works on directed graphs.
-  
-      typedef boost::on_finish_vertex event_filter;
+  template <typename height_type>
+  void dendrogram_from_merges(dendrogram<height_type>& dend, std::vector< weighted_edge<size_t, height_type> >& merge,
+			      const stop_criterion& stop = stop_criterion()){
+    // Build dend from merges found in arbitrary order. source and
+    // target of a merge are data points (representatives) of the two
+    // clusters. merge is sorted stably by weight.
+    parallel_stable_sort(merge.begin(), merge.end(), merge_weight_less<height_type>);
+    dend.linkage.clear();
+    dendrogram_from_sorted_merges(dend, merge, stop);
+  }
   
-      n_member_writer(property_map pm_): pm(pm_) {}
-
-      template <typename Graph, typename Vertex>
-      void operator()(const Vertex v, const Graph& G){
-	using namespace boost;
-	if(out_degree(v,G) == 0)
-	  pm[v] = 1;
-	else{
-	  pm[v] = 0;
-	  typename graph_traits<Graph>::adjacency_iterator ai, ai_end;
-	  for(tie(ai, ai_end) = adjacent_vertices(v, G); ai != ai_end; ++ai)
-	    pm[v] += pm[*ai];
-	}
-      }
   
-    protected:
-      property_map pm;
-    };
+  template <typename height_type, typename graph_mst>
+  void dendrogram_from_mst(dendrogram<height_type>& dend, const graph_mst& mst, const stop_criterion& stop = stop_criterion()){
+    // single-link dendrogram from a mst with edge_weight
+    using namespace std; using namespace boost;
+    typedef weighted_edge<size_t, height_type> merge_t;
 
+    vector<merge_t> merge;
+    merge.reserve(num_edges(mst));
+    typename graph_traits<graph_mst>::edge_iterator ei, ei_end;
+    for(tie(ei, ei_end) = edges(mst); ei != ei_end; ++ei)
+      merge.push_back((merge_t) {source(*ei, mst), target(*ei, mst), get(edge_weight, mst, *ei)});
 
-    template <typename Graph, typename Vertex, typename property_map>
-      void write_n_member(const Graph& G, const Vertex root, property_map pm){
-      using namespace boost;
-      // write number of members (i.e. number of leaves under a vertex) to a property map.
-      n_member_writer<property_map> writer(pm);
-      depth_first_search(G, visitor(make_dfs_visitor(writer)) .root_vertex(root));
-    }
+    dendrogram_from_merges(dend, merge, stop);
   }
-  
-  
+
+
   template <typename height_type, typename random_access_iterator, typename dissimilarity>
-  void single_link_mst(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d = dissimilarity()){
-    // single link in O(n^2) with a minimum spanning tree
+  void single_link_mst(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d = dissimilarity(),
+		       const stop_criterion& stop = stop_criterion()){
+    // single link in O(n^2) with a minimum spanning tree, the whole
+    // tree is needed even if stop ends the dendrogram early
     using namespace std; using namespace boost;
 
     // declare the mst
     // typedef typename property_traits<property_map>::value_type h_type;
     typedef adjacency_list<vecS, vecS, undirectedS, no_property, property<edge_weight_t, height_type> > mst_type;
-    typedef typename graph_traits<mst_type>::edge_descriptor mst_edge;
     mst_type mst;
 
     // get mst
@@ -207,11 +271,7 @@ namespace clusterol{
     // write_graphviz(cout, mst, make_label_writer(get(vertex_index, mst)), make_label_writer(get(&mst_edge_bundle<height_type>::weight, mst)));
 
     // get dendrogram
-    vector<mst_edge> corresponding_edge(2*num_vertices(mst) - 1); // unused variable
-    get_tree_from_mst(dend.tree, dend.height.begin(), corresponding_edge.begin(), mst, get(edge_weight, mst));
-
-    // write n_member for a nice fully specified  dendrogram
-    write_n_member(dend.tree, dend.root, dend.size.begin());
+    dendrogram_from_mst(dend, mst, stop);
   }
 }
 
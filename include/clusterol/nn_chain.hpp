@@ -0,0 +1,105 @@
+#ifndef _CLUSTEROL_NN_CHAIN_H_
+#define _CLUSTEROL_NN_CHAIN_H_
+
+#include "dendrogram.hpp"
+#include "lance_williams.hpp"
+#include "condensed_matrix.hpp"
+#include "minimum_spanning_tree.hpp"
+#include "profile.hpp"
+#include <vector>
+#include <algorithm>
+
+
+// Nearest-neighbor-chain clustering, O(n^2) time on a condensed_matrix.
+// Only valid for reducible methods, i.e. Lance-Williams formulas with
+// D(x, a OR b) >= min(D(x, a), D(x, b)) whenever D(a, b) <= both:
+// single link, complete link, group average, weighted group average
+// and ward. Centroid and median are not reducible.
+// Lit: Murtagh, "A survey of recent advances in hierarchical
+// clustering algorithms", 1983; Muellner, fastcluster, 2013.
+
+namespace clusterol{
+
+  template <typename height_type, typename lance_williams>
+  void nn_chain(condensed_matrix<height_type>& dis_mat, dendrogram<height_type>& dend, lance_williams lw,
+		const stop_criterion& stop = stop_criterion()){
+    // Cluster all rows of dis_mat. Clusters get ids in the order the
+    // chain finds them, dend is rebuilt in order of height at the end.
+    // The chain doesn't find merges in order, stop only shortens the
+    // rebuilt dendrogram.
+    typedef condensed_matrix<height_type> matrix_t;
+    typedef weighted_edge<size_t, height_type> merge_t;
+
+    CLUSTEROL_PROFILE_SCOPE("nn_chain");
+    size_t n = dis_mat.size();
+    size_t next_id = n;
+    std::vector<size_t> chain;
+    chain.reserve(n);
+    std::vector<merge_t> merge;
+    merge.reserve(n > 0 ? n - 1 : 0);
+
+    while(dis_mat.valid() > 1){
+      if(chain.empty())
+	chain.push_back(dis_mat.first_row());
+
+      // grow the chain until its tip and predecessor are reciprocal
+      // nearest neighbors. Ties prefer the predecessor, which
+      // guarantees termination.
+      for(;;){
+	size_t a = chain.back();
+	size_t prev = chain.size() > 1 ? chain[chain.size() - 2] : matrix_t::npos;
+	size_t b = prev;
+	height_type min = prev != matrix_t::npos ? dis_mat.at(a, prev) : 0;
+	for(size_t i = dis_mat.first_row(); i != matrix_t::npos; i = dis_mat.next_row(i)){
+	  if(i == a)
+	    continue;
+	  height_type d = dis_mat.at(a, i);
+	  if(b == matrix_t::npos || d < min){
+	    min = d;
+	    b = i;
+	  }
+	}
+
+	if(b == prev)
+	  break;
+	chain.push_back(b);
+      }
+
+      size_t a = chain.back(); chain.pop_back();
+      size_t b = chain.back(); chain.pop_back();
+      if(a > b)
+	std::swap(a, b);	// a keeps the merged cluster
+
+      size_t id_a = dis_mat.id(a);
+      size_t id_b = dis_mat.id(b);
+      size_t parent = next_id++;
+      dend.size[parent] = dend.size[id_a] + dend.size[id_b];
+      merge.push_back((merge_t) {a, b, dis_mat.at(a, b)});
+
+      // update dis_mat(a, *), each row only writes its own entry
+      CLUSTEROL_PROFILE_COUNT("lance_williams_evaluations", dis_mat.valid() - 2);
+      for(size_t i = dis_mat.first_row(); i != matrix_t::npos; i = dis_mat.next_row(i)){
+	if(i != a && i != b)
+	  dis_mat.at(a, i) = lw(dis_mat.id(i), id_a, id_b, dis_mat);
+      }
+
+      dis_mat.erase(id_b);
+      dis_mat.move(id_a, parent);
+    }
+
+    dendrogram_from_merges(dend, merge, stop);
+  }
+
+
+  template <typename height_type, typename random_access_iterator, typename dissimilarity, typename lance_williams>
+  void nn_chain_cluster(dendrogram<height_type>& dend, random_access_iterator data, random_access_iterator data_end, dissimilarity d, lance_williams lw,
+			const stop_criterion& stop = stop_criterion()){
+    // Cluster with the nearest-neighbor chain. If lance_williams needs
+    // to access property maps of dend, dend can not be generated here.
+    condensed_matrix<height_type> dis_mat(data, data_end, d);
+    nn_chain(dis_mat, dend, lw, stop);
+  }
+
+}
+
+#endif /* _CLUSTEROL_NN_CHAIN_H_ */
@@ -0,0 +1,93 @@
+#ifndef _CLUSTEROL_PARALLEL_H_
+#define _CLUSTEROL_PARALLEL_H_
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <vector>
+#include <algorithm>
+
+
+// Thin layer over OpenMP. Without OpenMP (no -fopenmp) everything
+// runs sequentially and the pragmas vanish.
+
+#ifdef _OPENMP
+#define CLUSTEROL_OMP(directive) _Pragma(#directive)
+#else
+#define CLUSTEROL_OMP(directive)
+#endif
+
+
+namespace clusterol{
+
+  inline int num_threads(){
+    // number of threads used by parallel regions
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  inline void set_num_threads(int n){
+    // n <= 0: use all cores
+#ifdef _OPENMP
+    omp_set_num_threads(n > 0 ? n : omp_get_num_procs());
+#else
+    (void) n;
+#endif
+  }
+
+  inline int num_threads_in_region(){
+    // number of threads of the current parallel region
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+  }
+
+  inline int thread_num(){
+    // index of the calling thread inside a parallel region
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
+
+
+  // below this many elements parallel_stable_sort runs sequentially
+  const size_t parallel_sort_cutoff = 1 << 16;
+
+  template <typename random_access_iterator, typename compare>
+  void parallel_stable_sort(random_access_iterator first, random_access_iterator last, compare comp){
+    // std::stable_sort on one chunk per thread, then pairwise merges
+    // of neighbouring chunks. Same result as std::stable_sort.
+    size_t n = last - first;
+    size_t n_chunk = num_threads();
+    if(n < parallel_sort_cutoff || n_chunk < 2){
+      std::stable_sort(first, last, comp);
+      return;
+    }
+
+    std::vector<size_t> bound(n_chunk + 1);
+    for(size_t c = 0; c <= n_chunk; ++c)
+      bound[c] = n * c / n_chunk;
+
+    CLUSTEROL_OMP(omp parallel for schedule(static, 1))
+    for(size_t c = 0; c < n_chunk; ++c)
+      std::stable_sort(first + bound[c], first + bound[c + 1], comp);
+
+    for(size_t width = 1; width < n_chunk; width *= 2){
+      CLUSTEROL_OMP(omp parallel for schedule(static, 1))
+      for(size_t c = 0; c < n_chunk; c += 2 * width){
+	if(c + width < n_chunk)
+	  std::inplace_merge(first + bound[c], first + bound[c + width], first + bound[std::min(c + 2 * width, n_chunk)], comp);
+      }
+    }
+  }
+
+}
+
+#endif /* _CLUSTEROL_PARALLEL_H_ */
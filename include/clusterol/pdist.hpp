@@ -0,0 +1,76 @@
+#ifndef _CLUSTEROL_PDIST_H_
+#define _CLUSTEROL_PDIST_H_
+
+#include "parallel.hpp"
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+
+// Pairwise dissimilarities of all data points into a condensed array
+// (upper triangle row by row, see condensed_matrix.hpp).
+// The triangle is cut into square tiles of pdist_tile rows and
+// columns, so both blocks of data points stay in cache while a tile
+// is filled. Tiles are handed out to the threads dynamically. A block
+// of rows can be computed on its own.
+
+namespace clusterol{
+
+  const size_t pdist_tile = 64;
+
+  inline size_t condensed_offset(size_t i, size_t n){
+    // position of (i, i + 1), the start of row i
+    return i * (2 * n - i - 1) / 2;
+  }
+
+
+  template <typename random_access_iterator, typename dissimilarity_t, typename output_iterator>
+  void pdist(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity, output_iterator out,
+	     size_t row_begin, size_t row_end){
+    // Rows [row_begin, row_end) of the condensed array, e.g. one block
+    // of a file at a time. out must point to their
+    // condensed_offset(row_end, n) - condensed_offset(row_begin, n)
+    // random access values.
+    size_t n = std::distance(data, data_end);
+    row_end = std::min(row_end, n);
+    if(n < 2 || row_begin >= row_end)
+      return;
+
+    // tiles (I, J) with I <= J in the upper triangle and rows of the block
+    size_t n_block = (n + pdist_tile - 1) / pdist_tile;
+    std::vector< std::pair<size_t, size_t> > tile;
+    for(size_t I = row_begin / pdist_tile; I * pdist_tile < row_end; ++I)
+      for(size_t J = I; J != n_block; ++J)
+	tile.push_back(std::make_pair(I, J));
+
+    size_t base = condensed_offset(row_begin, n);
+    CLUSTEROL_OMP(omp parallel firstprivate(dissimilarity))
+    {
+      CLUSTEROL_OMP(omp for schedule(dynamic))
+      for(size_t t = 0; t < tile.size(); ++t){
+	size_t i_begin = std::max(tile[t].first * pdist_tile, row_begin);
+	size_t i_end = std::min(tile[t].first * pdist_tile + pdist_tile, row_end);
+	size_t j_begin = tile[t].second * pdist_tile;
+	size_t j_end = std::min(j_begin + pdist_tile, n);
+
+	for(size_t i = i_begin; i < i_end; ++i){
+	  // offset of (i, j) is row_offset + j
+	  size_t row_offset = condensed_offset(i, n) - i - 1 - base;
+	  for(size_t j = std::max(j_begin, i + 1); j < j_end; ++j)
+	    out[row_offset + j] = dissimilarity(data[i], data[j]);
+	}
+      }
+    }
+  }
+
+
+  template <typename random_access_iterator, typename dissimilarity_t, typename output_iterator>
+  void pdist(random_access_iterator data, random_access_iterator data_end, dissimilarity_t dissimilarity, output_iterator out){
+    // out must point to n(n-1)/2 random access values
+    pdist(data, data_end, dissimilarity, out, 0, std::distance(data, data_end));
+  }
+
+}
+
+#endif /* _CLUSTEROL_PDIST_H_ */
@@ -0,0 +1,61 @@
+#ifndef _CLUSTEROL_PRECOMPUTED_H_
+#define _CLUSTEROL_PRECOMPUTED_H_
+
+#include <boost/iterator/counting_iterator.hpp>
+#include <algorithm>
+#include <cmath>
+
+
+// Cluster precomputed dissimilarities instead of data points.
+// The data points are the indices 0 .. n-1 (index_begin, index_end),
+// precomputed_dissimilarity looks them up in a condensed array (upper
+// triangle row by row, like R's dist and scipy's pdist, see
+// condensed_matrix.hpp). The array is not copied, it may live in a
+// memory mapped file.
+
+namespace clusterol{
+
+  typedef boost::counting_iterator<size_t> index_iterator;
+
+  inline index_iterator index_begin(){
+    return index_iterator(0);
+  }
+
+  inline index_iterator index_end(size_t n){
+    return index_iterator(n);
+  }
+
+
+  inline size_t condensed_size_to_n(size_t m){
+    // number of data points with m = n(n-1)/2 dissimilarities, 0 if
+    // there is no such n
+    size_t n = size_t((1 + std::sqrt(1 + 8 * double(m))) / 2);
+    while(n * (n - 1) / 2 > m)
+      --n;
+    while((n + 1) * n / 2 <= m)
+      ++n;
+    return n > 1 && n * (n - 1) / 2 == m ? n : 0;
+  }
+
+
+  template <typename value_type>
+  class precomputed_dissimilarity{
+  public:
+    precomputed_dissimilarity(const value_type* condensed_, size_t n_): condensed(condensed_), n(n_) {}
+
+    double operator()(size_t a, size_t b) const{
+      if(a == b)
+	return 0;
+      if(a > b)
+	std::swap(a, b);
+      return condensed[a * (2 * n - a - 3) / 2 + b - 1];
+    }
+
+  private:
+    const value_type* condensed;
+    size_t n;
+  };
+
+}
+
+#endif /* _CLUSTEROL_PRECOMPUTED_H_ */
@@ -0,0 +1,118 @@
+#ifndef _CLUSTEROL_PROFILE_H_
+#define _CLUSTEROL_PROFILE_H_
+
+#include <map>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+
+// Wall time of phases and event counters for profiling.
+// The hooks compile to nothing unless CLUSTEROL_PROFILE is defined
+// (see CMakeLists.txt). Compiled in, they record only after
+// profile::enable(), one branch per hook otherwise. Hooks sit at
+// coarse places (a whole join, a whole matrix), counters are added in
+// bulk there, never per pair. Phases may nest, e.g. join is part of
+// cluster.
+//   CLUSTEROL_PROFILE_SCOPE("name")      time until the end of the scope
+//   CLUSTEROL_PROFILE_COUNT("name", n)   add n to a counter
+
+namespace clusterol{
+  namespace profile{
+
+    struct phase{
+      double seconds;
+      size_t calls;
+    };
+
+    struct report{
+      report(): enabled(false) {}
+
+      std::mutex lock;
+      bool enabled;
+      std::map<std::string, phase> phases;
+      std::map<std::string, size_t> counters;
+    };
+
+    inline report& get_report(){
+      static report r;
+      return r;
+    }
+
+
+    inline void enable(){
+      get_report().enabled = true;
+    }
+
+    inline bool enabled(){
+      return get_report().enabled;
+    }
+
+    inline void count(const char* name, size_t n){
+      report& r = get_report();
+      if(!r.enabled)
+	return;
+      std::lock_guard<std::mutex> guard(r.lock);
+      r.counters[name] += n;
+    }
+
+
+    class scope_timer{
+    public:
+      scope_timer(const char* name_): name(name_), active(enabled()) {
+	if(active)
+	  start = std::chrono::steady_clock::now();
+      }
+
+      ~scope_timer(){
+	if(!active)
+	  return;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report& r = get_report();
+	std::lock_guard<std::mutex> guard(r.lock);
+	phase& p = r.phases[name];
+	p.seconds += seconds;
+	++p.calls;
+      }
+
+    private:
+      scope_timer(const scope_timer&);
+      scope_timer& operator=(const scope_timer&);
+
+      const char* name;
+      bool active;
+      std::chrono::steady_clock::time_point start;
+    };
+
+
+    inline void write_json(std::ostream& os){
+      // {"phases": {name: {"seconds": s, "calls": c}, ...}, "counters": {name: n, ...}}
+      report& r = get_report();
+      std::lock_guard<std::mutex> guard(r.lock);
+      os << std::setprecision(9) << "{\"phases\": {";
+      for(std::map<std::string, phase>::const_iterator i = r.phases.begin(); i != r.phases.end(); ++i)
+	os << (i == r.phases.begin() ? "" : ", ") << "\"" << i->first << "\": {\"seconds\": " << i->second.seconds
+	   << ", \"calls\": " << i->second.calls << "}";
+      os << "}, \"counters\": {";
+      for(std::map<std::string, size_t>::const_iterator i = r.counters.begin(); i != r.counters.end(); ++i)
+	os << (i == r.counters.begin() ? "" : ", ") << "\"" << i->first << "\": " << i->second;
+      os << "}}\n";
+    }
+
+  }
+}
+
+
+#ifdef CLUSTEROL_PROFILE
+#define CLUSTEROL_PROFILE_CONCAT_(a, b) a##b
+#define CLUSTEROL_PROFILE_CONCAT(a, b) CLUSTEROL_PROFILE_CONCAT_(a, b)
+#define CLUSTEROL_PROFILE_SCOPE(name) clusterol::profile::scope_timer CLUSTEROL_PROFILE_CONCAT(clusterol_profile_, __LINE__)(name)
+#define CLUSTEROL_PROFILE_COUNT(name, n) clusterol::profile::count(name, n)
+#else
+#define CLUSTEROL_PROFILE_SCOPE(name)
+#define CLUSTEROL_PROFILE_COUNT(name, n)
+#endif
+
+#endif /* _CLUSTEROL_PROFILE_H_ */
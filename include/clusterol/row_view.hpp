@@ -0,0 +1,159 @@
+#ifndef _CLUSTEROL_ROW_VIEW_H_
+#define _CLUSTEROL_ROW_VIEW_H_
+
+#include <iterator>
+#include <cstddef>
+
+
+// Data points stored row by row in external memory (e.g. a memory
+// mapped file), used in place of a vector of data points.
+// row_view is one data point with begin() and end(), row_iterator is
+// a random access iterator over the rows. Consecutive rows are
+// stride values apart, the values of a row are contiguous, so the
+// vectorized dissimilarities apply. Nothing is copied.
+
+namespace clusterol{
+
+  template <typename coordinate_type>
+  class row_view{
+  public:
+    typedef const coordinate_type* const_iterator;
+    typedef const_iterator iterator;
+
+    row_view(const coordinate_type* first_, size_t dim_): first(first_), dim(dim_) {}
+
+    const_iterator begin() const{
+      return first;
+    }
+
+    const_iterator end() const{
+      return first + dim;
+    }
+
+    size_t size() const{
+      return dim;
+    }
+
+    coordinate_type operator[](size_t j) const{
+      return first[j];
+    }
+
+  private:
+    const coordinate_type* first;
+    size_t dim;
+  };
+
+
+  template <typename coordinate_type>
+  class row_iterator{
+  public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef row_view<coordinate_type> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef row_view<coordinate_type> reference;
+    typedef void pointer;
+
+    row_iterator(): first(0), dim(0), stride(0) {}
+    row_iterator(const coordinate_type* first_, size_t dim_, size_t stride_)
+      : first(first_), dim(dim_), stride(stride_) {}
+
+    reference operator*() const{
+      return reference(first, dim);
+    }
+
+    reference operator[](difference_type i) const{
+      return reference(first + i * difference_type(stride), dim);
+    }
+
+    row_iterator& operator++(){
+      first += stride;
+      return *this;
+    }
+
+    row_iterator operator++(int){
+      row_iterator old = *this;
+      first += stride;
+      return old;
+    }
+
+    row_iterator& operator--(){
+      first -= stride;
+      return *this;
+    }
+
+    row_iterator operator--(int){
+      row_iterator old = *this;
+      first -= stride;
+      return old;
+    }
+
+    row_iterator& operator+=(difference_type i){
+      first += i * difference_type(stride);
+      return *this;
+    }
+
+    row_iterator& operator-=(difference_type i){
+      first -= i * difference_type(stride);
+      return *this;
+    }
+
+    row_iterator operator+(difference_type i) const{
+      row_iterator result = *this;
+      return result += i;
+    }
+
+    row_iterator operator-(difference_type i) const{
+      row_iterator result = *this;
+      return result -= i;
+    }
+
+    difference_type operator-(const row_iterator& other) const{
+      // both iterators must belong to the same rows
+      return (first - other.first) / difference_type(stride);
+    }
+
+    bool operator==(const row_iterator& other) const{
+      return first == other.first;
+    }
+
+    bool operator!=(const row_iterator& other) const{
+      return first != other.first;
+    }
+
+    bool operator<(const row_iterator& other) const{
+      return first < other.first;
+    }
+
+    bool operator>(const row_iterator& other) const{
+      return first > other.first;
+    }
+
+    bool operator<=(const row_iterator& other) const{
+      return first <= other.first;
+    }
+
+    bool operator>=(const row_iterator& other) const{
+      return first >= other.first;
+    }
+
+  private:
+    const coordinate_type* first;
+    size_t dim, stride;
+  };
+
+
+  template <typename coordinate_type>
+  row_iterator<coordinate_type> rows_begin(const coordinate_type* data, size_t dim, size_t stride){
+    // first of the rows at data
+    return row_iterator<coordinate_type>(data, dim, stride);
+  }
+
+  template <typename coordinate_type>
+  row_iterator<coordinate_type> rows_end(const coordinate_type* data, size_t n_row, size_t dim, size_t stride){
+    // one past the last of n_row rows at data
+    return row_iterator<coordinate_type>(data + n_row * stride, dim, stride);
+  }
+
+}
+
+#endif /* _CLUSTEROL_ROW_VIEW_H_ */
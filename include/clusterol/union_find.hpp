@@ -0,0 +1,51 @@
+#ifndef _CLUSTEROL_UNION_FIND_H_
+#define _CLUSTEROL_UNION_FIND_H_
+
+#include <vector>
+#include <utility>
+
+
+// Disjoint sets of 0 .. n-1 in two flat arrays, union by rank and
+// path halving. Nearly O(1) per operation, no allocation after
+// construction.
+
+namespace clusterol{
+
+  class union_find{
+  public:
+    union_find(size_t n)
+      : parent(n),
+	rank(n, 0)
+    {
+      for(size_t i = 0; i != n; ++i)
+	parent[i] = i;
+    }
+
+    size_t find(size_t x){
+      // representative of the set containing x
+      while(parent[x] != x){
+	parent[x] = parent[parent[x]];
+	x = parent[x];
+      }
+      return x;
+    }
+
+    size_t link(size_t a, size_t b){
+      // join the sets of representatives a and b, return the new
+      // representative
+      if(rank[a] < rank[b])
+	std::swap(a, b);
+      parent[b] = a;
+      if(rank[a] == rank[b])
+	++rank[a];
+      return a;
+    }
+
+  private:
+    std::vector<size_t> parent;
+    std::vector<unsigned char> rank;
+  };
+
+}
+
+#endif /* _CLUSTEROL_UNION_FIND_H_ */